@@ -10,6 +10,15 @@
 
 #include <sys/time.h>
 
+#ifdef __linux__
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 // A timer class for quickly checking the wall-clock performance of code.
 namespace Benchmark {
     static TimeT system_time () {
@@ -48,24 +57,219 @@ namespace Benchmark {
 	TimeT ProcessorTime::total () const
 	{
 		std::clock_t current = std::clock();
-		this->_total += std::clock() - this->_last;
+		this->_total += current - this->_last;
 		this->_last = current;
 		
 		return TimeT(this->_total) / TimeT(CLOCKS_PER_SEC);
 	}
 
-	Timer::Timer()
+	const char * Counts::name (Event event)
+	{
+		switch (event) {
+			case CYCLES: return "Cycles";
+			case INSTRUCTIONS: return "Instructions";
+			case CACHE_MISSES: return "Cache misses";
+			case BRANCH_MISSES: return "Branch misses";
+			case CONTEXT_SWITCHES: return "Context switches";
+			default: return "Unknown";
+		}
+	}
+
+	bool Counts::available () const
+	{
+		for (std::size_t event = 0; event < EVENT_COUNT; event += 1)
+			if (events[event] >= 0)
+				return true;
+
+		return false;
+	}
+
+	double Counts::instructions_per_cycle () const
+	{
+		if (events[CYCLES] <= 0 || events[INSTRUCTIONS] < 0)
+			return 0;
+
+		return double(events[INSTRUCTIONS]) / double(events[CYCLES]);
+	}
+
+	static Counts unavailable_counts ()
+	{
+		Counts counts;
+
+		for (std::size_t event = 0; event < Counts::EVENT_COUNT; event += 1)
+			counts.events[event] = -1;
+
+		return counts;
+	}
+
+#ifdef __linux__
+	static int open_event (Counts::Event event, pid_t thread, int leader)
+	{
+		struct perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+
+		attributes.size = sizeof(attributes);
+
+		switch (event) {
+			case Counts::CYCLES:
+				attributes.type = PERF_TYPE_HARDWARE, attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+				break;
+			case Counts::INSTRUCTIONS:
+				attributes.type = PERF_TYPE_HARDWARE, attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+				break;
+			case Counts::CACHE_MISSES:
+				attributes.type = PERF_TYPE_HARDWARE, attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+				break;
+			case Counts::BRANCH_MISSES:
+				attributes.type = PERF_TYPE_HARDWARE, attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+				break;
+			default:
+				attributes.type = PERF_TYPE_SOFTWARE, attributes.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+				break;
+		}
+
+		attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attributes.exclude_hv = 1;
+
+		// Context switches happen in the kernel, so excluding it would always count 0, and it's better to report them as unavailable.
+		if (attributes.type == PERF_TYPE_HARDWARE)
+			attributes.exclude_kernel = 1;
+
+		return syscall(SYS_perf_event_open, &attributes, thread, -1, leader, PERF_FLAG_FD_CLOEXEC);
+	}
+#endif
+
+	PerformanceCounters::PerformanceCounters ()
+	{
+#ifdef __linux__
+		DIR * tasks = opendir("/proc/self/task");
+
+		if (!tasks)
+			return;
+
+		while (struct dirent * entry = readdir(tasks)) {
+			pid_t thread = std::atoi(entry->d_name);
+
+			if (thread <= 0)
+				continue;
+
+			Group group;
+			group.leader = -1;
+
+			// The first event which can be opened leads the group, so that e.g. software events are still counted when hardware events are not available.
+			for (std::size_t event = 0; event < Counts::EVENT_COUNT; event += 1) {
+				int descriptor = open_event(Counts::Event(event), thread, group.leader);
+
+				if (descriptor == -1)
+					continue;
+
+				if (group.leader == -1)
+					group.leader = descriptor;
+
+				group.descriptors.push_back(descriptor);
+				group.events.push_back(Counts::Event(event));
+			}
+
+			if (!group.descriptors.empty())
+				_groups.push_back(group);
+		}
+
+		closedir(tasks);
+#endif
+
+		this->reset();
+	}
+
+	PerformanceCounters::~PerformanceCounters ()
 	{
+#ifdef __linux__
+		for (std::size_t i = 0; i < _groups.size(); i += 1)
+			for (std::size_t j = 0; j < _groups[i].descriptors.size(); j += 1)
+				close(_groups[i].descriptors[j]);
+#endif
+	}
+
+	bool PerformanceCounters::read (const Group & group, std::vector<unsigned long long> & values) const
+	{
+#ifdef __linux__
+		// The number of events, the time enabled and running, and then the value of each event.
+		std::vector<unsigned long long> buffer(3 + group.events.size());
+		std::size_t size = buffer.size() * sizeof(unsigned long long);
+
+		if (::read(group.leader, buffer.data(), size) != ssize_t(size))
+			return false;
+
+		values.assign(buffer.begin() + 3, buffer.end());
+		values.push_back(buffer[1]);
+		values.push_back(buffer[2]);
+
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void PerformanceCounters::reset ()
+	{
+		_baseline.resize(_groups.size());
+
+		for (std::size_t i = 0; i < _groups.size(); i += 1)
+			if (!read(_groups[i], _baseline[i]))
+				_baseline[i].clear();
+	}
+
+	Counts PerformanceCounters::total () const
+	{
+		Counts counts = unavailable_counts();
+		std::vector<unsigned long long> values;
+
+		for (std::size_t i = 0; i < _groups.size(); i += 1) {
+			const Group & group = _groups[i];
+			const std::vector<unsigned long long> & baseline = _baseline[i];
+			std::size_t count = group.events.size();
+
+			if (baseline.empty() || !read(group, values))
+				continue;
+
+			unsigned long long enabled = values[count] - baseline[count], running = values[count + 1] - baseline[count + 1];
+
+			// The group was never scheduled, e.g. because there are more hardware events than counters.
+			if (running == 0)
+				continue;
+
+			// If the counters were multiplexed with other events, the group only ran for part of the time, so scale the counts up to estimate the whole.
+			double scale = double(enabled) / double(running);
+
+			for (std::size_t j = 0; j < count; j += 1) {
+				long long & total = counts.events[group.events[j]];
+
+				if (total < 0)
+					total = 0;
+
+				total += (long long)((values[j] - baseline[j]) * scale);
+			}
+		}
+
+		return counts;
+	}
+
+	Timer::Timer(bool counters)
+	{
+		if (counters)
+			_counters = std::make_shared<PerformanceCounters>();
 	}
 
 	void Timer::reset ()
 	{
 		_wall_time.reset();
 		_processor_time.reset();
+
+		if (_counters)
+			_counters->reset();
 	}
 
 	Timer::Sample Timer::sample() const
 	{
-		return {_wall_time.total(), _processor_time.total()};
+		return {_wall_time.total(), _processor_time.total(), _counters ? _counters->total() : unavailable_counts()};
 	}
 }
\ No newline at end of file
@@ -10,6 +10,8 @@
 #define DictionarySort_Benchmark_h
 
 #include <ctime>
+#include <memory>
+#include <vector>
 
 // A timer class for quickly checking the wall-clock performance of code.
 namespace Benchmark {
@@ -37,13 +39,76 @@ namespace Benchmark {
 		TimeT total () const;
 	};
 
+	// Counts of hardware and software events. A count is negative if the event couldn't be counted.
+	struct Counts {
+		enum Event {
+			CYCLES,
+			INSTRUCTIONS,
+			// Misses in the last level cache.
+			CACHE_MISSES,
+			BRANCH_MISSES,
+			CONTEXT_SWITCHES,
+			EVENT_COUNT
+		};
+
+		long long events[EVENT_COUNT];
+
+		static const char * name(Event event);
+
+		bool available(Event event) const { return events[event] >= 0; }
+
+		// Whether any event could be counted.
+		bool available() const;
+
+		// Instructions per cycle, or 0 if either isn't available.
+		double instructions_per_cycle() const;
+	};
+
+	/** Performance Counters.
+
+		Counts events using Linux perf_event_open, summed over every thread in the process, e.g. the worker threads of a scheduler as well as the calling thread. Each thread has one group of counters, so that all of its events are counted over the same interval, and counts are scaled up if the kernel had to multiplex the counters.
+
+		Threads are found when the counters are constructed, so threads which are created afterwards are not counted. Hardware events are only counted in user space, so that they are available with the default perf_event_paranoid setting. Context switches are always counted by the kernel, so they may need a lower setting. Events which can't be counted, e.g. hardware events inside a virtual machine, or every event on other platforms, are reported as unavailable rather than failing.
+
+	 */
+	class PerformanceCounters {
+	protected:
+		struct Group {
+			int leader;
+			std::vector<int> descriptors;
+			std::vector<Counts::Event> events;
+		};
+
+		std::vector<Group> _groups;
+
+		// The values of each group when the counters were reset, followed by the time the group was enabled and running.
+		mutable std::vector<std::vector<unsigned long long> > _baseline;
+
+		bool read (const Group & group, std::vector<unsigned long long> & values) const;
+
+	public:
+		PerformanceCounters ();
+		~PerformanceCounters ();
+
+		bool available () const { return !_groups.empty(); }
+
+		void reset ();
+		Counts total () const;
+
+	private:
+		PerformanceCounters (const PerformanceCounters &);
+		PerformanceCounters & operator= (const PerformanceCounters &);
+	};
+
 	class Timer {
 	protected:
 		WallTime _wall_time;
 		ProcessorTime _processor_time;
+		std::shared_ptr<PerformanceCounters> _counters;
 
 	public:
-		Timer();
+		// If counters is true, performance counters are also sampled when they are available.
+		explicit Timer(bool counters = false);
 
 		const WallTime & wall_time() const { return _wall_time; }
 		const ProcessorTime & processor_time() const { return _processor_time; }
@@ -54,6 +119,9 @@ namespace Benchmark {
 			TimeT wall_time_total;
 			TimeT processor_time_total;
 
+			// Every event is unavailable unless the timer was constructed with counters.
+			Counts counts;
+
 			TimeT approximate_processor_usage() const {
 				return processor_time_total / wall_time_total;
 			}
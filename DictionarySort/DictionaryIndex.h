@@ -0,0 +1,216 @@
+//
+//  DictionaryIndex.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_DictionaryIndex_h
+#define DictionarySort_DictionaryIndex_h
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "DictionarySort.h"
+
+namespace DictionarySort {
+    /** Incremental Dictionary Index.
+
+        Dictionary::sort generates the order of every word and sorts all of them, so adding a few words to a large sorted list costs as much as sorting the whole list again. An index keeps the words in a store along with their orders, which are generated once when the words are inserted, and keeps the records sorted in runs.
+
+        Each batch of words is sorted on its own with Dictionary::sort, and becomes a new run. Runs are ordered from the oldest, which is the largest, to the newest. Whenever a run is not at least RUN_GROWTH_FACTOR times larger than the run after it, the two are merged with a parallel merge. So the runs shrink geometrically, there are O(log n) of them, and each word is merged O(log n) times over its lifetime: the amortised cost of inserting a batch depends on the size of the batch, not the size of the index. A small batch is only merged with runs of a similar size, and the largest run is only merged when the runs after it add up to about the same size.
+
+        Looking up a word searches every run. Listing the words in order compacts the index into a single run first, which can also be done ahead of time, e.g. when the index is idle. An index is not thread safe. Each batch is sorted by the dictionary, so it prints a report for every batch unless it is not verbose.
+
+            DictionaryIndex<char, IndexT[256]> index(dictionary);
+
+            index.insert(batch);
+            index.insert(another_batch);
+
+            index.contains(word);
+            index.sorted(permutation);
+
+     */
+    template <typename CharT, typename MapT, typename PolicyT = DefaultPolicy>
+    class DictionaryIndex {
+    public:
+        typedef Dictionary<CharT, MapT, PolicyT> DictionaryT;
+        typedef typename DictionaryT::WordT WordT;
+        typedef typename DictionaryT::WordsT WordsT;
+        typedef typename DictionaryT::WordStoreT WordStoreT;
+        typedef typename DictionaryT::PermutationT PermutationT;
+
+        // A run is merged into the run before it, unless that run is at least this many times larger.
+        static const std::size_t RUN_GROWTH_FACTOR = 2;
+
+        // The index refers to the dictionary for generating orders and sorting, so the dictionary must outlive it.
+        explicit DictionaryIndex(DictionaryT & dictionary, ParallelMergeSort::Scheduler & scheduler = ParallelMergeSort::Scheduler::shared())
+            : _dictionary(dictionary), _scheduler(scheduler)
+        {
+        }
+
+        // The words in the order they were inserted.
+        const WordStoreT & store() const { return _store; }
+
+        std::size_t size() const { return _store.size(); }
+        bool empty() const { return _store.empty(); }
+
+        // The number of sorted runs.
+        std::size_t runs() const { return _runs.size(); }
+
+        // Copy a batch of words into the index.
+        void insert(const WordsT & batch) {
+            std::size_t offset = _store.size();
+
+            for (std::size_t i = 0; i < batch.size(); i += 1)
+                _store.push_back(batch[i]);
+
+            insert(offset);
+        }
+
+        void insert(const WordStoreT & batch) {
+            std::size_t offset = _store.size();
+
+            for (std::size_t i = 0; i < batch.size(); i += 1) {
+                typename WordStoreT::Word word = batch[i];
+                _store.push_back(word.begin(), word.end());
+            }
+
+            insert(offset);
+        }
+
+        // Merge every run into one.
+        void compact() {
+            while (_runs.size() > 1)
+                merge();
+        }
+
+        // Whether a word equal to the given word, in the order of the dictionary, is in the index.
+        bool contains(const WordT & word) {
+            typename DictionaryT::OrderT order = _dictionary.sum(word);
+            WordRecord record = DictionaryT::record(order, 0);
+            CompareWordsAscending comparator(&_dictionary);
+
+            for (std::size_t i = 0; i < _runs.size(); i += 1) {
+                if (std::binary_search(_runs[i].begin(), _runs[i].end(), record, comparator))
+                    return true;
+            }
+
+            return false;
+        }
+
+        // Afterwards, permutation[i] is the index in the store of the i-th word in sorted order. Words which are equal are in the order they were inserted.
+        void sorted(PermutationT & permutation) {
+            compact();
+
+            permutation.resize(_store.size());
+
+            for (std::size_t i = 0; i < permutation.size(); i += 1)
+                permutation[i] = _runs[0][i].index;
+        }
+
+        // Copy the words in sorted order.
+        void sorted(WordsT & output) {
+            compact();
+
+            output.resize(_store.size());
+
+            for (std::size_t i = 0; i < output.size(); i += 1) {
+                typename WordStoreT::Word word = _store[_runs[0][i].index];
+                output[i].assign(word.begin(), word.end());
+            }
+        }
+
+        void clear() {
+            _store.clear();
+            _segments.clear();
+            _runs.clear();
+            WordRecordsT().swap(_scratch);
+        }
+
+    protected:
+        typedef typename DictionaryT::WordRecord WordRecord;
+        typedef typename DictionaryT::CompareWordsAscending CompareWordsAscending;
+        typedef std::vector<WordRecord> WordRecordsT;
+
+        DictionaryT & _dictionary;
+        ParallelMergeSort::Scheduler & _scheduler;
+
+        WordStoreT _store;
+
+        // The order of the words of each batch. Records point into these, so they are never resized.
+        std::deque<std::vector<IndexT> > _segments;
+
+        // Sorted records, from the oldest run to the newest.
+        std::vector<WordRecordsT> _runs;
+
+        // The destination of the last merge, which is kept for the next one.
+        WordRecordsT _scratch;
+
+        // Generate the order of the words from offset to the end of the store, sort them as a new run, and then merge runs until they shrink geometrically again.
+        void insert(std::size_t offset) {
+            std::size_t count = _store.size() - offset, total = 0;
+
+            if (count == 0)
+                return;
+
+            for (std::size_t i = offset; i < _store.size(); i += 1)
+                total += _dictionary.segment_count(_store.length(i));
+
+            _segments.push_back(std::vector<IndexT>(total));
+
+            IndexT * order = _segments.back().data();
+            WordRecordsT run(count);
+
+            for (std::size_t i = 0; i < count; i += 1) {
+                typename WordStoreT::Word word = _store[offset + i];
+                WordRecord record = {0, std::uint32_t(_dictionary.sum(word.begin(), word.end(), order)), std::uint32_t(offset + i), 0};
+
+                if (record.length > 0) {
+                    record.prefix = order[0];
+                    record.rest = order + 1;
+                }
+
+                run[i] = record;
+                order += record.length;
+            }
+
+            _dictionary.sort(run, PolicyT::SORT_MODE);
+            _runs.push_back(WordRecordsT());
+            _runs.back().swap(run);
+
+            while (_runs.size() > 1 && _runs[_runs.size() - 2].size() < RUN_GROWTH_FACTOR * _runs.back().size())
+                merge();
+        }
+
+        // Merge the newest run into the run before it. The newer run goes second, so equal words stay in the order they were inserted.
+        void merge() {
+            WordRecordsT & lower = _runs[_runs.size() - 2];
+            std::size_t middle_bound = lower.size();
+
+            lower.insert(lower.end(), _runs.back().begin(), _runs.back().end());
+            _runs.pop_back();
+
+            std::size_t count = lower.size();
+            CompareWordsAscending comparator(&_dictionary);
+
+            // Words which are inserted in order, e.g. appended to the end of the dictionary, don't need to be merged at all.
+            if (middle_bound == 0 || middle_bound == count || !comparator(lower[middle_bound], lower[middle_bound - 1]))
+                return;
+
+            std::size_t segments = 1;
+
+            if (PolicyT::PARALLEL_MERGE)
+                segments = std::max<std::size_t>(1, std::min(_scheduler.concurrency(), count / PolicyT::PARALLEL_MERGE_MINIMUM_COUNT));
+
+            _scratch.resize(count);
+
+            typedef typename WordRecordsT::iterator IteratorT;
+            ParallelMergeSort::ParallelMerge<IteratorT, IteratorT, CompareWordsAscending, PolicyT> parallel_merge = {lower.begin(), _scratch.begin(), comparator, 0, middle_bound, count, 0, count, segments, _scheduler};
+            parallel_merge();
+
+            lower.swap(_scratch);
+        }
+    };
+}
+
+#endif
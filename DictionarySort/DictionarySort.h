@@ -9,11 +9,22 @@
 #ifndef DictionarySort_DictionarySort_h
 #define DictionarySort_DictionarySort_h
 
+#include <algorithm>
 #include <cmath>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <type_traits>
 #include <vector>
 #include <map>
 
 #include "ParallelMergeSort.h"
+#include "PartialSort.h"
+#include "SIMD.h"
+#include "SortByKey.h"
+#include "Sorter.h"
+#include "Unicode.h"
+#include "WordStore.h"
 
 template <typename AnyT>
 struct pointer_less_than
@@ -26,18 +37,98 @@ struct pointer_less_than
 namespace DictionarySort {
     // Use std::sort
     //const int SORT_MODE = -1;
+    // Use ParallelMergeSort::radix_sort on the packed order of each word, see RadixSort.h
+    //const int SORT_MODE = -2;
+    // Use std::stable_sort, for comparison
+    //const int SORT_MODE = -3;
     // Use ParallelMergeSort with 2^n threads
     const int SORT_MODE = 3; // = n
     
+    // Scan for natural runs before sorting, which makes sorting nearly sorted input close to linear time, but costs an extra scan for random input.
+    const bool SORT_ADAPTIVE = false;
+    
+    // The options for sorting words with a dictionary, see ParallelMergeSort::DefaultPolicy. Derive from this to give a dictionary different options, e.g. to sort with a different mode by default, or with ParallelMergeSort::StablePolicy's kernels.
+    struct DefaultPolicy : public ParallelMergeSort::DefaultPolicy {
+        // The mode used by sort when none is given, as for SORT_MODE.
+        static const int SORT_MODE = DictionarySort::SORT_MODE;
+        
+        static const bool SORT_ADAPTIVE = DictionarySort::SORT_ADAPTIVE;
+    };
+    
     typedef std::uint64_t IndexT;
     
+    // Look up the order of a character without modifying the map (unlike std::map::operator[]), so that it is safe to call from multiple threads at the same time. Characters which are not in the map have order 0. Arrays are indexed by the unsigned value of the character, so that e.g. bytes >= 0x80 in a char buffer don't index before the array.
+    template <typename CharT, std::size_t N>
+    inline IndexT lookup_order(const IndexT (&map)[N], CharT character) {
+        return map[typename std::make_unsigned<CharT>::type(character)];
+    }
+    
+    template <typename CharT, typename MapT>
+    inline IndexT lookup_order(const MapT & map, CharT character) {
+        typename MapT::const_iterator i = map.find(character);
+        
+        return i != map.end() ? i->second : 0;
+    }
+    
+    template <typename CharT, std::size_t N>
+    inline void assign_order(IndexT (&map)[N], CharT character, IndexT order) {
+        map[typename std::make_unsigned<CharT>::type(character)] = order;
+    }
+    
+    template <typename CharT, typename MapT>
+    inline void assign_order(MapT & map, CharT character, IndexT order) {
+        map[character] = order;
+    }
+    
+    template <typename CharT>
+    inline IndexT lookup_order(const CodepointTable & map, CharT character) {
+        return map.find(CodepointT(character));
+    }
+    
+    template <typename CharT>
+    inline void assign_order(CodepointTable & map, CharT character, IndexT order) {
+        map.assign(CodepointT(character), std::uint32_t(order));
+    }
+    
+    // Otherwise the generic overloads above would be a better match for the derived table.
+    inline IndexT lookup_order(const UTF8Table & map, CodepointT character) {
+        return map.find(character);
+    }
+    
+    inline void assign_order(UTF8Table & map, CodepointT character, IndexT order) {
+        map.assign(character, std::uint32_t(order));
+    }
+    
+    // Read the next character from [begin, end), and advance past it. Every character is a single code unit, except in maps which decode their input, i.e. UTF8Table.
     template <typename CharT, typename MapT>
+    inline CharT next_character(const MapT &, const CharT *& begin, const CharT *) {
+        return *begin++;
+    }
+    
+    inline CodepointT next_character(const UTF8Table &, const char *& begin, const char * end) {
+        return decode_utf8(begin, end);
+    }
+    
+    // Whether characters may be more than one code unit, in which case a word has at most as many characters as code units.
+    template <typename MapT>
+    struct variable_width : std::false_type {};
+    
+    template <>
+    struct variable_width<UTF8Table> : std::true_type {};
+    
+    template <typename CharT, typename MapT, typename PolicyT = DefaultPolicy>
     class Dictionary {    
     public:
         typedef std::vector<CharT> WordT;
         typedef std::vector<WordT> WordsT;        
         typedef std::vector<IndexT> OrderT;
         
+        typedef WordStore<CharT> WordStoreT;
+        typedef std::vector<typename WordStoreT::WordIndexT> PermutationT;
+        
+        // The number of times each distinct word occurs, see sort_count.
+        typedef std::vector<std::uint32_t> CountsT;
+        
         static const int ORDERED_LT = -1;
         static const int ORDERED_EQ = 0;
         static const int ORDERED_GT = 1;
@@ -49,16 +140,11 @@ namespace DictionarySort {
         // ORDERED_GT => (lhs > rhs)
         static int compare(const OrderT & lhs, const OrderT & rhs)
         {
-            std::size_t offset = 0;
+            std::size_t count = std::min(lhs.size(), rhs.size());
+            std::size_t offset = SIMD::mismatch(lhs.data(), rhs.data(), count);
             
-            while (offset < lhs.size() && offset < rhs.size()) {
-                if (lhs[offset] < rhs[offset])
-                    return ORDERED_LT;
-                else if (lhs[offset] > rhs[offset])
-                    return ORDERED_GT;
-                
-                offset += 1;
-            }
+            if (offset < count)
+                return lhs[offset] < rhs[offset] ? ORDERED_LT : ORDERED_GT;
             
             if (lhs.size() == rhs.size())
                 return ORDERED_EQ;
@@ -71,56 +157,118 @@ namespace DictionarySort {
         }
         
         static int compare(Dictionary * dictionary, const WordT & lhs, const WordT & rhs) {
-            std::size_t offset = 0;
+            const CharT * left = lhs.data(), * left_end = left + lhs.size();
+            const CharT * right = rhs.data(), * right_end = right + rhs.size();
             
-            while (offset < lhs.size() && offset < rhs.size()) {
-                IndexT left_order = dictionary->_characterOrder[lhs[offset]];
-                IndexT right_order = dictionary->_characterOrder[rhs[offset]];
+            while (left != left_end && right != right_end) {
+                // Equal characters have equal order, so skip ahead to the next character which differs. This doesn't work for characters of variable width, since the first difference may be in the middle of a character.
+                if (!variable_width<MapT>::value) {
+                    std::size_t offset = SIMD::mismatch(left, right, std::min(left_end - left, right_end - right));
+                    
+                    left += offset, right += offset;
+                    
+                    if (left == left_end || right == right_end)
+                        break;
+                }
+                
+                IndexT left_order = lookup_order(dictionary->_characterOrder, next_character(dictionary->_characterOrder, left, left_end));
+                IndexT right_order = lookup_order(dictionary->_characterOrder, next_character(dictionary->_characterOrder, right, right_end));
                 
                 if (left_order < right_order)
                     return ORDERED_LT;
                 else if (left_order > right_order)
                     return ORDERED_GT;
-                
-                offset += 1;
             }
             
-            if (lhs.size() == rhs.size())
+            if (left == left_end && right == right_end)
                 return ORDERED_EQ;
             
-            if (offset < lhs.size())
+            if (left != left_end)
                 return ORDERED_GT;
             
             return ORDERED_LT;
         }
         
     private:
+        // The index keeps records and compares them in the same way as sort.
+        template <typename, typename, typename>
+        friend class DictionaryIndex;
+        
         WordT _alphabet;
         
         MapT _characterOrder;
         //int _characterOrder[256];
         //std::map<CharT, IndexT> _characterOrder;
+        //CodepointTable _characterOrder;
         
         IndexT width;
         IndexT characters_per_segment;
         
-        // This is a light weight wrapper over WordT which caches its OrderT, an integer representation of position based on the given dictionary.
+        // If every character is a single byte and its order fits in a byte, the order of each word is generated by the vector kernels, see SIMD.h.
+        bool _vectorize;
+        SIMD::Translation _translation;
+        
+        // If this profile is not empty, it chooses the parallel configuration for each sort instead of the fixed tree depth given by the sort mode.
+        ParallelMergeSort::Profile _profile;
+        
+        // Print the time taken by each sort to std::cerr.
+        bool _verbose;
+        
+        // This is a light weight wrapper over WordT along with its OrderT, an integer representation of position based on the given dictionary.
         struct OrderedWord {
             WordT word;
             
-            // We can generate this as part of the sorting process. Because the sort is parallel, generation of word order (which is relatively expensive) is distributed across multiple processors.
-            mutable OrderT order;
+            // This is generated for every word before sorting, so comparisons only ever read it. Generation of word order is relatively expensive, so it is distributed across all workers, see prepare.
+            OrderT order;
+        };
+        
+        // A compact sort record for an OrderedWord, which is sorted by value. Most comparisons are decided by the first segment of the order, which is stored inline, so they don't need to load the word or its order from the heap. Only records with the same prefix compare the rest of the order.
+        struct WordRecord {
+            // The first segment of the order, or 0 if the word is empty.
+            IndexT prefix;
+            
+            // The number of segments in the order, and the index of the word which this record is for.
+            std::uint32_t length, index;
+            
+            // The remaining length - 1 segments of the order.
+            const IndexT * rest;
+        };
+        
+        static WordRecord record(const OrderT & order, std::size_t index) {
+            WordRecord record = {0, std::uint32_t(order.size()), std::uint32_t(index), 0};
+            
+            if (order.size() > 0) {
+                record.prefix = order[0];
+                record.rest = order.data() + 1;
+            }
+            
+            return record;
+        }
+        
+        // Records for words which are not empty have a non-zero prefix, so if the prefixes are equal, either both words are empty or both have a prefix and length - 1 more segments.
+        static int compare(const WordRecord & lhs, const WordRecord & rhs) {
+            if (lhs.prefix < rhs.prefix)
+                return ORDERED_LT;
+            else if (lhs.prefix > rhs.prefix)
+                return ORDERED_GT;
+            
+            std::size_t count = std::min(lhs.length, rhs.length);
             
-            // The first time this function is called, it must be guaranteed from a single thread.
-            // After that, it can be called from multiple threads at the same time.
-            // The parallel merge sort algorithm guarantees this.
-            const OrderT & fetch_order(Dictionary * dictionary) const {
-                if (order.size() == 0 && word.size() > 0)
-                    order = dictionary->sum(word);
+            if (count > 1) {
+                std::size_t offset = SIMD::mismatch(lhs.rest, rhs.rest, count - 1);
                 
-                return order;
+                if (offset < count - 1)
+                    return lhs.rest[offset] < rhs.rest[offset] ? ORDERED_LT : ORDERED_GT;
             }
-        };
+            
+            if (lhs.length == rhs.length)
+                return ORDERED_EQ;
+            
+            if (lhs.length > rhs.length)
+                return ORDERED_GT;
+            
+            return ORDERED_LT;
+        }
         
         struct CompareWordsAscending {
             Dictionary * dictionary;
@@ -135,7 +283,26 @@ namespace DictionarySort {
             }
             
             bool operator()(const OrderedWord * a, const OrderedWord * b) const {
-                return compare(a->fetch_order(dictionary), b->fetch_order(dictionary)) == ORDERED_LT;
+                return compare(a->order, b->order) == ORDERED_LT;
+            }
+            
+            bool operator()(const WordRecord & a, const WordRecord & b) const {
+                // Most comparisons are decided here:
+                if (a.prefix != b.prefix)
+                    return a.prefix < b.prefix;
+                
+                return compare(a, b) == ORDERED_LT;
+            }
+        };
+        
+        // The segments of each word's order, for radix sorting.
+        struct WordKey {
+            std::size_t size(const WordRecord & record) const {
+                return record.length;
+            }
+            
+            IndexT operator()(const WordRecord & record, std::size_t segment) const {
+                return segment == 0 ? record.prefix : record.rest[segment-1];
             }
         };
         
@@ -153,39 +320,95 @@ namespace DictionarySort {
             }
         };
         
+        typedef std::vector<WordRecord> WordRecordsT;
+        
+        // Smaller inputs are prepared for sorting on a single thread.
+        static const std::size_t PREPARE_MINIMUM_COUNT = 1024 * 16;
+        
+        // These are kept between calls to sort, so that sorting the same number of words again doesn't allocate.
+        std::vector<OrderedWord> _allocation;
+        WordRecordsT _records;
+        
+        // The order of every word when sorting a WordStore.
+        std::vector<IndexT> _segments;
+        ParallelMergeSort::Sorter<WordRecord> _sorter;
+        
+        // The scratch buffer for counts, which are merged alongside the records by sort_count.
+        CountsT _count_scratch;
+        
     public:
         Dictionary(WordT alphabet)
-        : _alphabet(alphabet)
+        : _alphabet(alphabet), _characterOrder(), _verbose(true)
         {
             IndexT index = 1;
             
+            _vectorize = sizeof(CharT) == 1 && !variable_width<MapT>::value && alphabet.size() < 256;
+            _translation.clear();
+            
             // Build up the character order map
-            for (typename WordT::iterator i = _alphabet.begin(); i != _alphabet.end(); ++i) {
-                _characterOrder[*i] = index;
+            const CharT * begin = _alphabet.data(), * end = begin + _alphabet.size();
+            
+            while (begin != end) {
+                const CharT * character = begin;
+                
+                assign_order(_characterOrder, next_character(_characterOrder, begin, end), index);
+                
+                if (_vectorize)
+                    _translation.assign(std::uint8_t(*character), std::uint8_t(index));
+                
                 index += 1;
             }
             
-            width = std::ceil(std::log(alphabet.size()) / std::log(2));
+            // Enough bits for the largest index, which is the number of letters, since 0 is reserved for characters which are not in the alphabet.
+            width = std::ceil(std::log(index) / std::log(2));
             
             // Naturally floor the result by integer division/truncation.
             characters_per_segment = (sizeof(IndexT) * 8) / width;
         }
         
-        OrderT sum(const WordT & word) {
+        // The number of segments in the order of a word with the given number of characters. For characters of variable width, this is an upper bound given the number of code units.
+        std::size_t segment_count(std::size_t length) const {
+            return (length + characters_per_segment - 1) / characters_per_segment;
+        }
+        
+        // The memory used to sort a word of the given length with sort(store, permutation): the word and its delimiter, its offset in the store, its order, its record and the scratch space for sorting it, and its index in the permutation.
+        std::size_t sort_memory(std::size_t length) const {
+            return (length + 1) * sizeof(CharT) + sizeof(std::size_t) + segment_count(length) * sizeof(IndexT) + 2 * sizeof(WordRecord) + sizeof(typename WordStoreT::WordIndexT);
+        }
+        
+        OrderT sum(const WordT & word) const {
             OrderT order;
-            std::size_t index = 0;
             
-            while (index < word.size()) {
+            sum(word, order);
+            
+            return order;
+        }
+        
+        // As above, reusing the storage of the given order. This only reads the dictionary, so it is safe to call from multiple threads at the same time.
+        void sum(const WordT & word, OrderT & order) const {
+            order.resize(segment_count(word.size()));
+            order.resize(sum(word.data(), word.data() + word.size(), order.data()));
+        }
+        
+        // As above, writing at most segment_count(end - begin) segments to order, and returning the number of segments written.
+        std::size_t sum(const CharT * begin, const CharT * end, IndexT * order) const {
+            if (_vectorize) {
+                SIMD::kernels().sum(_translation, (const std::uint8_t *)begin, end - begin, width, characters_per_segment, order);
+                
+                return segment_count(end - begin);
+            }
+            
+            IndexT * first = order;
+            
+            while (begin != end) {
                 IndexT count = characters_per_segment;
                 IndexT sum = 0;
                 
-                while (index < word.size()) {
+                while (begin != end) {
                     count -= 1;
                     
                     sum <<= width;
-                    sum += _characterOrder[word[index]];
-                    
-                    index += 1;
+                    sum += lookup_order(_characterOrder, next_character(_characterOrder, begin, end));
                     
                     if (count == 0)
                         break;
@@ -193,26 +416,130 @@ namespace DictionarySort {
                 
                 // Shift along any remaining count, since we are ordering using the left most significant character.
                 sum <<= (count * width);
-                order.push_back(sum);
+                *order++ = sum;
             }
             
-            return order;
+            return order - first;
         }
                 
-        // The words will be sorted in-place.
+        const ParallelMergeSort::Profile & profile() const { return _profile; }
+        void set_profile(const ParallelMergeSort::Profile & profile) { _profile = profile; }
+        
+        bool verbose() const { return _verbose; }
+        void set_verbose(bool verbose) { _verbose = verbose; }
+        
+        // Measure the cost of sorting a representative sample of words on this host, and estimate a profile for sorting words with this dictionary.
+        ParallelMergeSort::Profile calibrate(const WordsT & sample)
+        {
+            std::vector<OrderedWord> allocation(sample.size());
+            WordRecordsT records(sample.size());
+            
+            for (std::size_t i = 0; i < sample.size(); i += 1) {
+                allocation[i].word = sample[i];
+                sum(allocation[i].word, allocation[i].order);
+                records[i] = record(allocation[i].order, i);
+            }
+            
+            return ParallelMergeSort::calibrate<PolicyT>(records, CompareWordsAscending(this), ParallelMergeSort::Scheduler::shared());
+        }
+        
+        // The words will be sorted in-place. If k is less than the number of words, only the first k words are sorted, see ParallelMergeSort::partial_sort, and the order of the rest is unspecified.
         template <typename ToSortT>
-        void sort (ToSortT & words, int mode = 2)
+        void sort (ToSortT & words, int mode = 2, std::size_t k = std::numeric_limits<std::size_t>::max())
         {
-            CompareWordsAscending comparator(this);
+			// Performance counters are only opened if they will be printed.
+			Benchmark::Timer sort_timer(_verbose);
 
-			Benchmark::Timer sort_timer;
+            sort_words(words, mode, k);
 
-            if (mode == -1) {
+			report(sort_timer);
+        }
+        
+        // As sort, without timing or reporting it, for sorts which are part of a larger operation, e.g. sort_unique.
+        template <typename ToSortT>
+        void sort_words (ToSortT & words, int mode, std::size_t k = std::numeric_limits<std::size_t>::max())
+        {
+            CompareWordsAscending comparator(this);
+
+            if (k < words.size()) {
+                if (mode < 0) {
+                    std::partial_sort(words.begin(), words.begin() + k, words.end(), comparator);
+                } else {
+                    ParallelMergeSort::Configuration configuration = _profile.configuration(words.size(), ParallelMergeSort::Configuration(mode, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT));
+                    
+                    ParallelMergeSort::partial_sort<PolicyT>(words.begin(), words.end(), k, comparator, configuration, _sorter.scheduler());
+                }
+            } else if (mode == -1) {
                 // Sort the words using built-in sorting algorithm, for comparison:
                 std::sort(words.begin(), words.end(), comparator);
-            } else {                
-                ParallelMergeSort::sort(words, comparator, std::size_t(mode));
+            } else if (mode == -2) {
+                // Sort the words by their order vector, one byte at a time, falling back to comparisons for small buckets:
+                WordKey key;
+                _sorter.radix_sort(words.begin(), words.end(), key, comparator);
+            } else if (mode == -3) {
+                std::stable_sort(words.begin(), words.end(), comparator);
+            } else {
+                ParallelMergeSort::Configuration configuration = _profile.configuration(words.size(), ParallelMergeSort::Configuration(mode, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT));
+                
+                if (PolicyT::SORT_ADAPTIVE)
+                    _sorter.template sort_adaptive<PolicyT>(words, comparator, configuration);
+                else
+                    _sorter.template sort<PolicyT>(words, comparator, configuration);
+            }
+        }
+        
+        // Sort the records, keeping only the first record of each distinct word, see ParallelMergeSort::sort_unique. If counts are given, they are merged alongside the records, and afterwards counts[i] is the number of times the i-th distinct word occurs. Negative modes sort all of the records and then remove the duplicates in a separate pass, for comparison, in which case the record which is kept is only the first for mode -3 (std::stable_sort).
+        void sort_unique(int mode, CountsT * counts = 0)
+        {
+            CompareWordsAscending comparator(this);
+            std::size_t count = _records.size();
+            
+			Benchmark::Timer sort_timer(_verbose);
+            
+            if (counts)
+                counts->assign(count, 1);
+            
+            if (mode < 0) {
+                // Every record starts with a count of one, so the counts don't need to be sorted along with the records.
+                sort_words(_records, mode);
+                
+                std::size_t kept = 0;
+                
+                for (std::size_t i = 0; i < count; i += 1) {
+                    if (kept > 0 && !comparator(_records[kept-1], _records[i])) {
+                        if (counts)
+                            (*counts)[kept-1] += 1;
+                    } else {
+                        _records[kept++] = _records[i];
+                    }
+                }
+                
+                count = kept;
+            } else {
+                ParallelMergeSort::Configuration configuration = _profile.configuration(count, ParallelMergeSort::Configuration(mode, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT));
+                
+                if (counts) {
+                    _count_scratch.resize(count);
+                    
+                    count = _sorter.template sort_unique_by_key<PolicyT>(_records.begin(), _records.end(), counts->begin(), comparator, ParallelMergeSort::AddValues(), configuration, _count_scratch.begin()) - _records.begin();
+                } else {
+                    count = _sorter.template sort_unique<PolicyT>(_records.begin(), _records.end(), comparator, ParallelMergeSort::KeepFirst(), configuration) - _records.begin();
+                }
             }
+            
+            _records.resize(count);
+            
+            if (counts)
+                counts->resize(count);
+            
+			report(sort_timer);
+        }
+        
+        // Print the time taken by a sort, and its performance counters, if verbose.
+        void report(Benchmark::Timer & sort_timer)
+        {
+			if (!_verbose)
+				return;
 
 			auto sample = sort_timer.sample();
 
@@ -220,51 +547,268 @@ namespace DictionarySort {
             std::cerr << "	* Dictionary sort time: " << sample.wall_time_total << std::endl;
 			std::cerr << "	* Processor sort time: " << sample.processor_time_total << std::endl;
 			std::cerr << "	* Approximate processor usage: " << sample.approximate_processor_usage() << std::endl;
+			
+			if (sample.counts.available()) {
+				for (std::size_t event = 0; event < Benchmark::Counts::EVENT_COUNT; event += 1) {
+					if (sample.counts.available(Benchmark::Counts::Event(event)))
+						std::cerr << "	* " << Benchmark::Counts::name(Benchmark::Counts::Event(event)) << ": " << sample.counts.events[event] << std::endl;
+				}
+				
+				if (sample.counts.instructions_per_cycle() > 0)
+					std::cerr << "	* Instructions per cycle: " << sample.counts.instructions_per_cycle() << std::endl;
+			} else {
+				std::cerr << "	* Performance counters are not available." << std::endl;
+			}
         }
         
-        // This function can be slow due to the large amount of memory required for large datasets.
-        uint64_t sort(const WordsT & input, WordsT & output)
+        // Copy the words in [lower_bound, upper_bound] and generate their order and records. Every word is written by exactly one task, so this can run in parallel.
+        void prepare(const WordsT & input, std::size_t lower_bound, std::size_t upper_bound, std::size_t)
         {
-            typedef std::vector<OrderedWord*> OrderedWordsT;
-
-            // Allocate all words in one go:
-            OrderedWord * allocation = new OrderedWord[input.size()];
-            
-            // Copy pointers to intermediate list which will be used for sorting:
-            OrderedWordsT words(input.size());
-            
-            // Calculate order vector for each word in preparation for sort.
-            for (std::size_t i = 0; i < input.size(); i += 1) {
-                words[i] = &allocation[i];
+            for (std::size_t i = lower_bound; i < upper_bound; i += 1) {
+                OrderedWord & word = _allocation[i];
+                
+                word.word = input[i];
+                sum(word.word, word.order);
+                
+                _records[i] = record(word.order, i);
+            }
+        }
+        
+        // Generate the order of the words in [lower_bound, upper_bound] into _segments starting at segment_offset, and their records. The words are not copied.
+        void prepare(const WordStoreT & store, std::size_t lower_bound, std::size_t upper_bound, std::size_t segment_offset)
+        {
+            for (std::size_t i = lower_bound; i < upper_bound; i += 1) {
+                typename WordStoreT::Word word = store[i];
+                IndexT * order = _segments.data() + segment_offset;
+                WordRecord record = {0, std::uint32_t(sum(word.begin(), word.end(), order)), std::uint32_t(i), 0};
+                
+                if (record.length > 0) {
+                    record.prefix = order[0];
+                    record.rest = order + 1;
+                }
                 
-                words[i]->word = input[i];
+                _records[i] = record;
+                segment_offset += record.length;
+            }
+        }
+        
+        // Allocate storage for preparing the input, and compute the offset into _segments of each chunk.
+        void allocate(const WordsT & input, std::vector<std::size_t> &)
+        {
+            // Allocate all words in one go, reusing the words (and their storage) from the previous sort:
+            _allocation.resize(input.size());
+        }
+        
+        void allocate(const WordStoreT & store, std::vector<std::size_t> & segment_offsets)
+        {
+            std::size_t count = store.size(), chunks = segment_offsets.size(), total = 0;
+            
+            for (std::size_t i = 0, chunk = 0; i < count; i += 1) {
+                while (chunk < chunks && i == count * chunk / chunks)
+                    segment_offsets[chunk++] = total;
                 
-                // We can force generation of the order cache, but performance may be reduced by about 10%.
-                //words[i]->fetch_order(this);
+                total += segment_count(store.length(i));
+            }
+            
+            _segments.resize(total);
+        }
+        
+        template <typename InputT>
+        struct ParallelPrepare {
+            Dictionary * dictionary;
+            const InputT & input;
+            std::size_t lower_bound, upper_bound, segment_offset;
+            
+            void operator()() {
+                dictionary->prepare(input, lower_bound, upper_bound, segment_offset);
+            }
+        };
+        
+        // Prepare every word for sorting, using one chunk per worker. Afterwards, the order and record of every word are only read, so comparisons are safe for any parallel configuration.
+        template <typename InputT>
+        void prepare(const InputT & input)
+        {
+            ParallelMergeSort::Scheduler & scheduler = _sorter.scheduler();
+            std::size_t count = input.size();
+            std::size_t chunks = std::max<std::size_t>(1, std::min(scheduler.concurrency(), count / PREPARE_MINIMUM_COUNT));
+            
+            std::vector<std::size_t> segment_offsets(chunks);
+            allocate(input, segment_offsets);
+            _records.resize(count);
+            
+            std::deque<ParallelMergeSort::Scheduler::FunctorTask<ParallelPrepare<InputT> > > tasks;
+            
+            for (std::size_t i = 0; i < chunks; i += 1) {
+                ParallelPrepare<InputT> parallel_prepare = {this, input, count * i / chunks, count * (i+1) / chunks, segment_offsets[i]};
+                tasks.emplace_back(parallel_prepare);
             }
             
+            scheduler.fork_join(tasks);
+        }
+        
+        // Release the memory which is kept between calls to sort.
+        void clear()
+        {
+            std::vector<OrderedWord>().swap(_allocation);
+            WordRecordsT().swap(_records);
+            std::vector<IndexT>().swap(_segments);
+            CountsT().swap(_count_scratch);
+            _sorter.clear();
+        }
+        
+        // Compute a very simple checksum of the first count sorted records for verifying sorted order.
+        uint64_t checksum(std::size_t count = std::numeric_limits<std::size_t>::max()) const
+        {
+            WordKey key;
+            uint64_t checksum = 1, offset = 1;
+            
+            for (typename WordRecordsT::const_iterator i = _records.begin(); i != _records.begin() + std::min(count, _records.size()); ++i) {
+                for (std::size_t segment = 0; segment < i->length; segment += 1) {
+                    // Repeated words can cancel each other out, so the checksum may be 0.
+                    uint64_t step = offset++;
+                    checksum ^= key(*i, segment) + (checksum ? step % checksum : step);
+                }
+            }
+            
+            return checksum;
+        }
+        
+        // This function can be slow due to the large amount of memory required for large datasets. The memory is kept for the next call, so this function is not thread safe.
+        uint64_t sort(const WordsT & input, WordsT & output)
+        {
+            // Copy the words and calculate their order vectors and records in preparation for sort:
+            prepare(input);
+            
             // Change the mode from -1 for std::sort, to 0..n for ParallelMergeSort where 2^n is the number of threads to use.
-            sort(words, SORT_MODE);
+            sort(_records, PolicyT::SORT_MODE);
             
             // Prepare container for sorted output:
             output.reserve(input.size());
             output.resize(0);
             
-            uint64_t checksum = 1, offset = 1;
             // Copy sorted words to output vector.
-            for (typename OrderedWordsT::iterator i = words.begin(); i != words.end(); ++i) {
-                output.push_back((*i)->word);
-                
-                // Compute a very simple checksum for verifying sorted order.
-                const OrderT & order = (*i)->fetch_order(this);
-                for (typename OrderT::const_iterator j = order.begin(); j != order.end(); ++j) {
-                    checksum ^= *j + (offset++ % checksum);
-                }                
+            for (typename WordRecordsT::iterator i = _records.begin(); i != _records.end(); ++i) {
+                output.push_back(_allocation[i->index].word);
             }
             
-            delete[] allocation;
+            return checksum();
+        }
+        
+        // Sort the words in the store without copying them. Afterwards, permutation[i] is the index in the store of the i-th word in sorted order. The order of every word is generated into one contiguous array of segments, which the records refer to. As above, the memory is kept for the next call. The mode selects the algorithm, as for SORT_MODE, and defaults to the policy's.
+        uint64_t sort(const WordStoreT & store, PermutationT & permutation, int mode = PolicyT::SORT_MODE)
+        {
+            prepare(store);
+            
+            sort(_records, mode);
             
-            return checksum;
+            permutation.resize(_records.size());
+            
+            for (std::size_t i = 0; i < _records.size(); i += 1) {
+                permutation[i] = _records[i].index;
+            }
+            
+            return checksum();
+        }
+        
+        // As sort(input, output), but only the first k words in sorted order are output, which for small k costs little more than preparing the words. The checksum is of those words.
+        uint64_t partial_sort(const WordsT & input, WordsT & output, std::size_t k)
+        {
+            prepare(input);
+            
+            sort(_records, PolicyT::SORT_MODE, k);
+            
+            std::size_t count = std::min(k, _records.size());
+            
+            output.reserve(count);
+            output.resize(0);
+            
+            for (std::size_t i = 0; i < count; i += 1) {
+                output.push_back(_allocation[_records[i].index].word);
+            }
+            
+            return checksum(count);
+        }
+        
+        // As sort(store, permutation, mode), but afterwards permutation only has the first k words in sorted order.
+        uint64_t partial_sort(const WordStoreT & store, PermutationT & permutation, std::size_t k, int mode = PolicyT::SORT_MODE)
+        {
+            prepare(store);
+            
+            sort(_records, mode, k);
+            
+            permutation.resize(std::min(k, _records.size()));
+            
+            for (std::size_t i = 0; i < permutation.size(); i += 1) {
+                permutation[i] = _records[i].index;
+            }
+            
+            return checksum(permutation.size());
+        }
+        
+        // As sort(input, output), but each distinct word is only output once, e.g. for building a dictionary from a corpus. Duplicates are removed during every merge, so the sort only moves the distinct words of each partition. The checksum is of the distinct words.
+        uint64_t sort_unique(const WordsT & input, WordsT & output)
+        {
+            prepare(input);
+            
+            sort_unique(PolicyT::SORT_MODE);
+            
+            output.reserve(_records.size());
+            output.resize(0);
+            
+            for (std::size_t i = 0; i < _records.size(); i += 1) {
+                output.push_back(_allocation[_records[i].index].word);
+            }
+            
+            return checksum();
+        }
+        
+        // As sort_unique(input, output), and afterwards counts[i] is the number of times output[i] occurs in the input.
+        uint64_t sort_count(const WordsT & input, WordsT & output, CountsT & counts)
+        {
+            prepare(input);
+            
+            sort_unique(PolicyT::SORT_MODE, &counts);
+            
+            output.reserve(_records.size());
+            output.resize(0);
+            
+            for (std::size_t i = 0; i < _records.size(); i += 1) {
+                output.push_back(_allocation[_records[i].index].word);
+            }
+            
+            return checksum();
+        }
+        
+        // As sort(store, permutation, mode), but afterwards permutation has the index of the first occurrence of each distinct word.
+        uint64_t sort_unique(const WordStoreT & store, PermutationT & permutation, int mode = PolicyT::SORT_MODE)
+        {
+            prepare(store);
+            
+            sort_unique(mode);
+            
+            permutation.resize(_records.size());
+            
+            for (std::size_t i = 0; i < _records.size(); i += 1) {
+                permutation[i] = _records[i].index;
+            }
+            
+            return checksum();
+        }
+        
+        // As sort_unique(store, permutation, mode), and afterwards counts[i] is the number of times the word at permutation[i] occurs in the store.
+        uint64_t sort_count(const WordStoreT & store, PermutationT & permutation, CountsT & counts, int mode = PolicyT::SORT_MODE)
+        {
+            prepare(store);
+            
+            sort_unique(mode, &counts);
+            
+            permutation.resize(_records.size());
+            
+            for (std::size_t i = 0; i < _records.size(); i += 1) {
+                permutation[i] = _records[i].index;
+            }
+            
+            return checksum();
         }
     };
 }
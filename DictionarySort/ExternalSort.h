@@ -0,0 +1,654 @@
+//
+//  ExternalSort.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_ExternalSort_h
+#define DictionarySort_ExternalSort_h
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "DictionarySort.h"
+#include "MappedFile.h"
+#include "Scheduler.h"
+
+namespace DictionarySort {
+    // Files are read and written in blocks of at most this many characters. Each file has two blocks, so that the next block is transferred while the current one is used.
+    const std::size_t EXTERNAL_BLOCK_SIZE = 1024 * 1024;
+
+    // Smaller blocks make too many small transfers, so the memory budget is exceeded rather than using them.
+    const std::size_t EXTERNAL_MINIMUM_BLOCK_SIZE = 1024 * 64;
+
+    // Runs are merged as they are sorted, so a few levels of runs may be open at once. The fan-in is limited so that this many levels, along with the input, the output and anything else the process has open, stay within the limit on open files.
+    const std::size_t EXTERNAL_OPEN_LEVELS = 8;
+    const std::size_t EXTERNAL_RESERVED_FILES = 32;
+
+    inline void throw_system_error(int error, const std::string & what) {
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    /** Write Behind Buffer.
+
+        Characters are copied into the current block, and when it is full, it is written to the file by a task on the I/O scheduler while the next block is filled. Only one write is ever in flight, so the file is written sequentially.
+
+     */
+    template <typename CharT>
+    class BlockWriter {
+    public:
+        BlockWriter(int descriptor, std::size_t block_size, ParallelMergeSort::Scheduler & io)
+            : _descriptor(descriptor), _io(io), _current(block_size), _writing(block_size), _size(0), _error(0)
+        {
+        }
+
+        ~BlockWriter() {
+            if (_pending)
+                _io.join(*_pending);
+        }
+
+        void write(const CharT * begin, const CharT * end) {
+            while (begin != end) {
+                std::size_t count = std::min<std::size_t>(end - begin, _current.size() - _size);
+
+                std::copy(begin, begin + count, _current.begin() + _size);
+                _size += count;
+                begin += count;
+
+                if (_size == _current.size())
+                    submit();
+            }
+        }
+
+        void put(CharT character) {
+            _current[_size++] = character;
+
+            if (_size == _current.size())
+                submit();
+        }
+
+        // Write any buffered characters, and wait for every write to complete. Throws std::system_error if any write failed.
+        void flush() {
+            submit();
+            wait();
+        }
+
+    protected:
+        struct WriteBlock {
+            int descriptor;
+            const CharT * buffer;
+            std::size_t size;
+            int * error;
+
+            void operator()() {
+                const char * data = (const char *)buffer;
+                std::size_t remaining = size * sizeof(CharT);
+
+                while (remaining > 0) {
+                    ssize_t result = ::write(descriptor, data, remaining);
+
+                    if (result == -1) {
+                        if (errno == EINTR)
+                            continue;
+
+                        *error = errno;
+                        return;
+                    }
+
+                    data += result;
+                    remaining -= result;
+                }
+            }
+        };
+
+        typedef ParallelMergeSort::Scheduler::FunctorTask<WriteBlock> WriteTask;
+
+        int _descriptor;
+        ParallelMergeSort::Scheduler & _io;
+
+        // The block being filled, and the block being written.
+        std::vector<CharT> _current, _writing;
+        std::size_t _size;
+
+        // A task can't be run again, so each write has its own.
+        std::unique_ptr<WriteTask> _pending;
+        int _error;
+
+        void wait() {
+            if (_pending) {
+                _io.join(*_pending);
+                _pending.reset();
+            }
+
+            if (_error)
+                throw_system_error(_error, "Could not write block");
+        }
+
+        void submit() {
+            if (_size == 0)
+                return;
+
+            wait();
+
+            _current.swap(_writing);
+
+            WriteBlock write_block = {_descriptor, _writing.data(), _size, &_error};
+            _pending.reset(new WriteTask(write_block));
+            _io.fork(*_pending);
+
+            _size = 0;
+        }
+    };
+
+    /** Read Ahead Buffer.
+
+        Reads a file with one word per delimiter, one block at a time. While the words in the current block are used, the next block is read by a task on the I/O scheduler. A word which spans two blocks is copied, every other word refers directly to the block.
+
+     */
+    template <typename CharT>
+    class BlockReader {
+    public:
+        BlockReader(int descriptor, CharT delimiter, std::size_t block_size, ParallelMergeSort::Scheduler & io)
+            : _descriptor(descriptor), _delimiter(delimiter), _io(io), _current(block_size), _next(block_size), _size(0), _offset(0), _next_size(0), _position(0), _error(0), _begin(0), _end(0)
+        {
+            read();
+        }
+
+        ~BlockReader() {
+            if (_pending)
+                _io.join(*_pending);
+        }
+
+        // Advance to the next word, which is valid until the next call. Returns false at the end of the file. Throws std::system_error if a read failed.
+        bool next() {
+            _line.clear();
+
+            while (true) {
+                if (_offset == _size && !fill()) {
+                    // A file should end with a delimiter, but a final word without one is still a word.
+                    if (_line.empty())
+                        return false;
+
+                    _begin = _line.data();
+                    _end = _begin + _line.size();
+
+                    return true;
+                }
+
+                const CharT * begin = _current.data() + _offset, * end = _current.data() + _size;
+                const CharT * delimiter = std::find(begin, end, _delimiter);
+
+                if (delimiter != end) {
+                    _offset += (delimiter - begin) + 1;
+
+                    if (_line.empty()) {
+                        _begin = begin;
+                        _end = delimiter;
+                    } else {
+                        _line.insert(_line.end(), begin, delimiter);
+                        _begin = _line.data();
+                        _end = _begin + _line.size();
+                    }
+
+                    return true;
+                }
+
+                // The word continues in the next block.
+                _line.insert(_line.end(), begin, end);
+                _offset = _size;
+            }
+        }
+
+        const CharT * begin() const { return _begin; }
+        const CharT * end() const { return _end; }
+
+    protected:
+        struct ReadBlock {
+            int descriptor;
+            off_t position;
+            CharT * buffer;
+            std::size_t capacity;
+            std::size_t * size;
+            int * error;
+
+            void operator()() {
+                char * data = (char *)buffer;
+                std::size_t total = 0, count = capacity * sizeof(CharT);
+
+                while (total < count) {
+                    ssize_t result = pread(descriptor, data + total, count - total, position + total);
+
+                    if (result == -1) {
+                        if (errno == EINTR)
+                            continue;
+
+                        *error = errno;
+                        break;
+                    }
+
+                    if (result == 0)
+                        break;
+
+                    total += result;
+                }
+
+                *size = total / sizeof(CharT);
+            }
+        };
+
+        typedef ParallelMergeSort::Scheduler::FunctorTask<ReadBlock> ReadTask;
+
+        int _descriptor;
+        CharT _delimiter;
+        ParallelMergeSort::Scheduler & _io;
+
+        // The block being used, and the block being read.
+        std::vector<CharT> _current, _next;
+        std::size_t _size, _offset, _next_size;
+
+        // The position in the file of the next block to read.
+        off_t _position;
+
+        std::unique_ptr<ReadTask> _pending;
+        int _error;
+
+        // The current word, which is either in the current block or in _line.
+        const CharT * _begin, * _end;
+        std::vector<CharT> _line;
+
+        void read() {
+            ReadBlock read_block = {_descriptor, _position, _next.data(), _next.size(), &_next_size, &_error};
+            _position += _next.size() * sizeof(CharT);
+
+            _pending.reset(new ReadTask(read_block));
+            _io.fork(*_pending);
+        }
+
+        // Make the block which was read ahead the current block, and start reading the one after it. Returns false at the end of the file.
+        bool fill() {
+            if (!_pending)
+                return false;
+
+            _io.join(*_pending);
+            _pending.reset();
+
+            if (_error)
+                throw_system_error(_error, "Could not read block");
+
+            _current.swap(_next);
+            _size = _next_size;
+            _offset = 0;
+
+            if (_size == 0)
+                return false;
+
+            read();
+
+            return true;
+        }
+    };
+
+    /** Loser Tree.
+
+        Selects the smallest current item of a number of sources, e.g. for a k-way merge. Each internal node holds the loser of the match played there, and the root holds the overall winner, so when the winner advances to its next item, only the matches on the path from its leaf to the root are played again: log2(k) comparisons, each against a loser which is already known, compared with the k - 1 comparisons of a linear scan, or up to 2 log2(k) for a binary heap.
+
+     */
+    template <typename LessT>
+    class LoserTree {
+    public:
+        // less(a, b) compares the current items of the sources with index a and b.
+        LoserTree(std::size_t count, const LessT & less)
+            : _count(count), _less(less), _nodes(std::max<std::size_t>(count, 1), count)
+        {
+            // Every node starts with a virtual source which beats every real source, and each of these is knocked out in turn as the real sources play their way in.
+            for (std::size_t i = count; i > 0; i -= 1)
+                replay(i - 1);
+        }
+
+        // The source with the smallest current item.
+        std::size_t winner() const {
+            return _nodes[0];
+        }
+
+        // The current item of the given source changed, e.g. the winner advanced to its next item.
+        void replay(std::size_t source) {
+            std::size_t winner = source;
+
+            for (std::size_t node = (source + _count) / 2; node > 0; node /= 2) {
+                if (beats(_nodes[node], winner))
+                    std::swap(_nodes[node], winner);
+            }
+
+            _nodes[0] = winner;
+        }
+
+    protected:
+        std::size_t _count;
+        LessT _less;
+
+        // The leaves are implicit: source i is at node _count + i, and the parent of node n is n / 2.
+        std::vector<std::size_t> _nodes;
+
+        bool beats(std::size_t a, std::size_t b) const {
+            if (a == _count)
+                return b != _count;
+
+            if (b == _count)
+                return false;
+
+            return _less(a, b);
+        }
+    };
+
+    /** External Merge Sort.
+
+        Sorts a file with one word per line which is larger than the available memory. The file is mapped, and split into runs of consecutive lines which can each be sorted with Dictionary::sort(store, permutation) within the memory budget, see Dictionary::sort_memory. Each run is sorted in place in the mapping by the usual parallel sort, written to a temporary file, and then its pages are released. While a run is being sorted, the kernel is asked to read the next one.
+
+        The sorted runs are then merged using a loser tree, reading every run and writing the output in blocks on a dedicated I/O thread, so that disk transfers overlap the merge. If there are too many runs to give each one two blocks within the memory budget, groups of adjacent runs are merged into longer runs first. This starts while the runs are being sorted: whenever the last fan-in runs are all the result of the same number of merges, they are merged into one, so the number of temporary files which are open only grows with the logarithm of the size of the input. Words which compare equal are always taken from the earliest run, so, like the in-memory sort, the result is stable.
+
+        If the whole file fits in one run, it is sorted and written directly to the output, without any temporary files.
+
+     */
+    template <typename CharT, typename MapT>
+    class ExternalSort {
+    public:
+        typedef Dictionary<CharT, MapT> DictionaryT;
+        typedef typename DictionaryT::WordStoreT WordStoreT;
+        typedef typename DictionaryT::PermutationT PermutationT;
+        typedef typename DictionaryT::OrderT OrderT;
+
+        ExternalSort(DictionaryT & dictionary, std::size_t memory_budget, const std::string & temporary_directory = "/tmp", CharT delimiter = CharT('\n'), ParallelMergeSort::Scheduler & scheduler = ParallelMergeSort::Scheduler::shared())
+            : _dictionary(dictionary), _memory_budget(memory_budget), _temporary_directory(temporary_directory), _delimiter(delimiter), _scheduler(scheduler), _io(1)
+        {
+        }
+
+        ~ExternalSort() {
+            close_runs(0, _runs.size());
+        }
+
+        // Sort the lines of the input, and write them to the given file descriptor. Returns the number of runs which were sorted. Throws std::system_error if a temporary file can't be created, read or written.
+        std::size_t sort(const MappedFile & input, int output);
+
+    protected:
+        DictionaryT & _dictionary;
+        std::size_t _memory_budget;
+        std::string _temporary_directory;
+        CharT _delimiter;
+
+        // Sorting runs uses every worker, while reading and writing blocks has its own thread so that blocking I/O never holds up a worker.
+        ParallelMergeSort::Scheduler & _scheduler;
+        ParallelMergeSort::Scheduler _io;
+
+        // A sorted run which hasn't been merged yet, and how many times its words have been merged, which decides when runs are merged while sorting.
+        struct Run {
+            int descriptor;
+            std::size_t level;
+        };
+
+        // The temporary file of each run, in input order. The files are already unlinked.
+        std::deque<Run> _runs;
+
+        // A run being merged, and the order of its current word.
+        struct Source {
+            BlockReader<CharT> reader;
+            OrderT order;
+            bool done;
+
+            Source(int descriptor, CharT delimiter, std::size_t block_size, ParallelMergeSort::Scheduler & io)
+                : reader(descriptor, delimiter, block_size, io), done(false)
+            {
+            }
+        };
+
+        struct CompareSources {
+            const std::deque<Source> & sources;
+
+            bool operator()(std::size_t a, std::size_t b) const {
+                const Source & lhs = sources[a], & rhs = sources[b];
+
+                // A finished source loses to every other source.
+                if (lhs.done || rhs.done) {
+                    if (lhs.done != rhs.done)
+                        return rhs.done;
+                } else {
+                    int order = DictionaryT::compare(lhs.order, rhs.order);
+
+                    if (order != DictionaryT::ORDERED_EQ)
+                        return order == DictionaryT::ORDERED_LT;
+                }
+
+                // Equal words are taken from the earliest run first.
+                return a < b;
+            }
+        };
+
+        // Each sorted run is written with blocks from at most a quarter of the memory budget, and sorted within the rest.
+        std::size_t write_block_size() const {
+            return std::max(EXTERNAL_MINIMUM_BLOCK_SIZE, std::min(EXTERNAL_BLOCK_SIZE, _memory_budget / (8 * sizeof(CharT))));
+        }
+
+        // Each run being merged, and the output, has two blocks.
+        std::size_t merge_block_size(std::size_t count) const {
+            return std::max(EXTERNAL_MINIMUM_BLOCK_SIZE, std::min(EXTERNAL_BLOCK_SIZE, _memory_budget / (2 * (count + 1) * sizeof(CharT))));
+        }
+
+        // The most runs which can be merged at once with blocks of the given size, within the memory budget and the limit on open files.
+        std::size_t merge_fan_in(std::size_t block_size) const {
+            std::size_t blocks = _memory_budget / (2 * block_size * sizeof(CharT));
+            std::size_t fan_in = blocks > 3 ? blocks - 1 : 2;
+
+            struct rlimit limit;
+
+            if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+                std::size_t files = limit.rlim_cur > EXTERNAL_RESERVED_FILES ? std::size_t(limit.rlim_cur) - EXTERNAL_RESERVED_FILES : 0;
+
+                fan_in = std::min(fan_in, std::max<std::size_t>(2, files / EXTERNAL_OPEN_LEVELS));
+            }
+
+            return fan_in;
+        }
+
+        // The end of the longest sequence of lines starting at begin which can be sorted within the memory budget. This always includes at least one line, even if it doesn't fit.
+        const CharT * split(const CharT * begin, const CharT * end) const {
+            std::size_t budget = _memory_budget - _memory_budget / 4;
+            std::size_t memory = 0, words = 0;
+            const CharT * line = begin;
+
+            while (line != end && words < std::numeric_limits<typename WordStoreT::WordIndexT>::max()) {
+                const CharT * delimiter = std::find(line, end, _delimiter);
+
+                memory += _dictionary.sort_memory(delimiter - line);
+
+                if (memory > budget && line != begin)
+                    break;
+
+                line = (delimiter == end) ? end : delimiter + 1;
+                words += 1;
+            }
+
+            return line;
+        }
+
+        // Create an unlinked temporary file for a new run, and add it to the end of the list of runs.
+        int create_run(std::size_t level) {
+            std::string path = _temporary_directory + "/DictionarySort.XXXXXX";
+            std::vector<char> name(path.begin(), path.end());
+            name.push_back(0);
+
+            int descriptor = mkstemp(name.data());
+
+            if (descriptor == -1)
+                throw_system_error(errno, "Could not create temporary file in " + _temporary_directory);
+
+            // Nothing else needs the name, and this way the file is removed when it is closed, even if the process is killed.
+            unlink(name.data());
+
+            Run run = {descriptor, level};
+            _runs.push_back(run);
+
+            return descriptor;
+        }
+
+        // Close and forget count runs starting at first.
+        void close_runs(std::size_t first, std::size_t count) {
+            for (std::size_t i = first; i < first + count; i += 1)
+                close(_runs[i].descriptor);
+
+            _runs.erase(_runs.begin() + first, _runs.begin() + first + count);
+        }
+
+        void write(const WordStoreT & store, const PermutationT & permutation, int descriptor) {
+            BlockWriter<CharT> writer(descriptor, write_block_size(), _io);
+
+            for (std::size_t i = 0; i < permutation.size(); i += 1) {
+                typename WordStoreT::Word word = store[permutation[i]];
+
+                writer.write(word.begin(), word.end());
+                writer.put(_delimiter);
+            }
+
+            writer.flush();
+        }
+
+        void advance(Source & source) {
+            source.done = !source.reader.next();
+
+            if (!source.done) {
+                source.order.resize(_dictionary.segment_count(source.reader.end() - source.reader.begin()));
+                source.order.resize(_dictionary.sum(source.reader.begin(), source.reader.end(), source.order.data()));
+            }
+        }
+
+        // Merge count runs starting at first into the given file.
+        void merge(std::size_t first, std::size_t count, int output, std::size_t block_size) {
+            // A deque never moves its elements, which the pending reads require.
+            std::deque<Source> sources;
+
+            for (std::size_t i = first; i < first + count; i += 1) {
+                sources.emplace_back(_runs[i].descriptor, _delimiter, block_size, _io);
+                advance(sources.back());
+            }
+
+            BlockWriter<CharT> writer(output, block_size, _io);
+            CompareSources compare_sources = {sources};
+            LoserTree<CompareSources> tree(count, compare_sources);
+
+            while (!sources[tree.winner()].done) {
+                std::size_t winner = tree.winner();
+                Source & source = sources[winner];
+
+                writer.write(source.reader.begin(), source.reader.end());
+                writer.put(_delimiter);
+
+                advance(source);
+                tree.replay(winner);
+            }
+
+            writer.flush();
+        }
+
+        // Whether the last fan_in runs have been merged the same number of times. Levels never increase along the list of runs, so only the first and last of them need to be checked.
+        bool collapsible(std::size_t fan_in) const {
+            return _runs.size() >= fan_in && _runs[_runs.size() - fan_in].level == _runs.back().level;
+        }
+
+        // Merge the last fan_in runs into one while they have been merged the same number of times, so that fewer than fan_in runs of each level are left open.
+        void collapse(std::size_t fan_in) {
+            while (collapsible(fan_in)) {
+                std::size_t first = _runs.size() - fan_in;
+
+                merge(first, fan_in, create_run(_runs.back().level + 1), merge_block_size(fan_in));
+                close_runs(first, fan_in);
+            }
+        }
+
+        // Merge every run into the output.
+        void merge(int output) {
+            std::size_t block_size = merge_block_size(_runs.size());
+            std::size_t fan_in = merge_fan_in(block_size);
+
+            // Merge groups of adjacent runs into longer runs, until there are few enough to merge at once. The merged runs are added to the end of the list, so the runs stay in input order.
+            while (_runs.size() > fan_in) {
+                std::size_t count = _runs.size();
+
+                for (std::size_t i = 0; i < count; i += fan_in) {
+                    std::size_t group = std::min(fan_in, count - i);
+
+                    if (group == 1) {
+                        _runs.push_back(_runs.front());
+                        _runs.pop_front();
+                    } else {
+                        merge(0, group, create_run(_runs.front().level + 1), block_size);
+                        close_runs(0, group);
+                    }
+                }
+            }
+
+            merge(0, _runs.size(), output, block_size);
+            close_runs(0, _runs.size());
+        }
+    };
+
+    template <typename CharT, typename MapT>
+    std::size_t ExternalSort<CharT, MapT>::sort(const MappedFile & input, int output) {
+        const CharT * begin = (const CharT *)input.begin(), * end = begin + input.size() / sizeof(CharT);
+        std::size_t run_count = 0;
+
+        // Runs are merged while sorting with the smallest blocks, which merges the most runs at once.
+        std::size_t fan_in = merge_fan_in(EXTERNAL_MINIMUM_BLOCK_SIZE);
+
+        {
+            WordStoreT store(_delimiter);
+            PermutationT permutation;
+
+            for (const CharT * run = begin; run != end; run_count += 1) {
+                const CharT * run_end = split(run, end);
+
+                // Read ahead the next run while sorting this one.
+                input.will_need((const char *)run_end, (const char *)std::min(end, run_end + (run_end - run)));
+
+                store.reference(run, run_end, _scheduler);
+                _dictionary.sort(store, permutation);
+
+                // If everything fits in one run, there is nothing to merge.
+                if (run == begin && run_end == end)
+                    write(store, permutation, output);
+                else
+                    write(store, permutation, create_run(0));
+
+                input.dont_need((const char *)run, (const char *)run_end);
+
+                // Merging has its own memory budget, so release the memory used for sorting first.
+                if (collapsible(fan_in)) {
+                    store = WordStoreT(_delimiter);
+                    PermutationT().swap(permutation);
+                    _dictionary.clear();
+
+                    collapse(fan_in);
+                }
+
+                run = run_end;
+            }
+        }
+
+        if (!_runs.empty()) {
+            // The merge has its own memory budget.
+            _dictionary.clear();
+
+            merge(output);
+        }
+
+        return run_count;
+    }
+}
+
+#endif
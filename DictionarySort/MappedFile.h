@@ -0,0 +1,106 @@
+//
+//  MappedFile.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_MappedFile_h
+#define DictionarySort_MappedFile_h
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace DictionarySort {
+    /** Read Only File Mapping.
+
+        Maps an entire file into memory, so that its contents can be referenced in place, e.g. by WordStore::reference. The pages are backed by the file, so the kernel can drop them again under memory pressure, which means a mapping can be much larger than the available memory as long as only part of it is used at a time.
+
+     */
+    class MappedFile {
+    public:
+        MappedFile() : _descriptor(-1), _data(0), _size(0) {}
+
+        ~MappedFile() {
+            if (_data)
+                munmap((void *)_data, _size);
+
+            if (_descriptor != -1)
+                close(_descriptor);
+        }
+
+        // Returns false and leaves errno set if the file can't be opened or mapped.
+        bool open(const std::string & path) {
+            _descriptor = ::open(path.c_str(), O_RDONLY);
+
+            if (_descriptor == -1)
+                return false;
+
+            struct stat status;
+            if (fstat(_descriptor, &status) == -1)
+                return false;
+
+            _size = status.st_size;
+
+            // An empty file can't be mapped, but it is valid input.
+            if (_size == 0)
+                return true;
+
+            void * data = mmap(0, _size, PROT_READ, MAP_PRIVATE, _descriptor, 0);
+
+            if (data == MAP_FAILED)
+                return false;
+
+            _data = (const char *)data;
+
+            return true;
+        }
+
+        const char * begin() const { return _data; }
+        const char * end() const { return _data + _size; }
+        std::size_t size() const { return _size; }
+
+        // Start reading the pages containing [begin, end) in the background.
+        void will_need(const char * begin, const char * end) const {
+            advise(page(begin), end, MADV_WILLNEED);
+        }
+
+        // Release the pages which are entirely within [begin, end), which will be read from the file again if they are used.
+        void dont_need(const char * begin, const char * end) const {
+            const char * first = page(begin + page_size() - 1);
+
+            if (first < end)
+                advise(first, page(end), MADV_DONTNEED);
+        }
+
+    private:
+        MappedFile(const MappedFile &);
+        MappedFile & operator=(const MappedFile &);
+
+        int _descriptor;
+        const char * _data;
+        std::size_t _size;
+
+        static std::size_t page_size() {
+            static const std::size_t size = sysconf(_SC_PAGESIZE);
+
+            return size;
+        }
+
+        // The start of the page containing the given address.
+        static const char * page(const char * address) {
+            return (const char *)((std::size_t)address & ~(page_size() - 1));
+        }
+
+        // Advice is only a hint, so failures are ignored.
+        void advise(const char * begin, const char * end, int advice) const {
+            if (_data && begin < end)
+                madvise((void *)begin, end - begin, advice);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,382 @@
+//
+//  MergeKernel.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_MergeKernel_h
+#define DictionarySort_MergeKernel_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PARALLEL_MERGE_SORT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace ParallelMergeSort {
+    /** Merge Kernels.
+
+        Merging is a loop over an unpredictable comparison: for random input, the branch which decides which side to take next is mispredicted about half of the time, and this dominates the cost of merging small keys. When the items are arithmetic and compared with std::less, the comparison is cheap and has no side effects, so the merge can be done without branching on it:
+
+        - The branchless kernel selects the next item with a conditional move and advances both sides by the result of the comparison.
+        - For 32 and 64 bit integers and floating point items in contiguous memory, the vector kernel merges 8 or 4 items at a time using a bitonic merge network (Inoue et al., AA-sort), taking the next block of items from the side with the smaller next item. This requires AVX2, which is checked at runtime.
+
+        The branchless kernel takes ties from the lower sequence first. The vector kernel may reorder items which compare equal, but for arithmetic items that can only be observed for -0.0 and 0.0, which the sorting networks used for the base case may also reorder. StableMergeKernel uses the branchless kernel only.
+
+     */
+
+    // Pointers and vector iterators refer to contiguous items, which the vector kernel loads directly. Proxy iterators, e.g. those of std::vector<bool>, don't refer to items in memory, so they are never contiguous.
+    template <typename IteratorT>
+    struct contiguous_iterator : std::integral_constant<bool,
+        (std::is_pointer<IteratorT>::value || std::is_same<IteratorT, typename std::vector<typename std::iterator_traits<IteratorT>::value_type>::iterator>::value)
+        && std::is_same<typename std::iterator_traits<IteratorT>::reference, typename std::iterator_traits<IteratorT>::value_type &>::value> {};
+
+    // Merge [left, left_end] and [right, right_end] of source into destination starting at offset, taking ties from the left first. This is the fallback for any comparator.
+    template <typename ComparatorT, typename ValueT, bool BRANCHLESS = std::is_arithmetic<ValueT>::value && std::is_same<ComparatorT, std::less<ValueT> >::value>
+    struct MergeKernel {
+        template <typename SourceT, typename DestinationT>
+        static void merge(SourceT source, DestinationT destination, const ComparatorT & comparator, std::size_t left, std::size_t left_end, std::size_t right, std::size_t right_end, std::size_t offset) {
+            while (left < left_end && right < right_end) {
+                if (comparator(source[right], source[left])) {
+                    destination[offset++] = std::move(source[right++]);
+                } else {
+                    destination[offset++] = std::move(source[left++]);
+                }
+            }
+
+            std::move(source + left, source + left_end, destination + offset);
+            std::move(source + right, source + right_end, destination + offset + (left_end - left));
+        }
+    };
+
+    // As above, without branching on the comparison.
+    template <typename SourceT, typename DestinationT>
+    inline DestinationT branchless_merge(SourceT left, SourceT left_end, SourceT right, SourceT right_end, DestinationT destination) {
+        typedef typename std::iterator_traits<SourceT>::value_type ValueT;
+
+        while (left != left_end && right != right_end) {
+            ValueT a = *left, b = *right;
+            bool take_right = b < a;
+
+            *destination++ = take_right ? b : a;
+
+            left += !take_right;
+            right += take_right;
+        }
+
+        destination = std::copy(left, left_end, destination);
+
+        return std::copy(right, right_end, destination);
+    }
+
+#ifdef PARALLEL_MERGE_SORT_X86
+    inline bool avx2_supported() {
+        static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+
+        return supported;
+    }
+
+    enum VectorKind {
+        VECTOR_SIGNED, VECTOR_UNSIGNED, VECTOR_FLOATING
+    };
+
+    template <typename ValueT>
+    struct vector_kind : std::integral_constant<VectorKind, std::is_floating_point<ValueT>::value ? VECTOR_FLOATING : std::is_signed<ValueT>::value ? VECTOR_SIGNED : VECTOR_UNSIGNED> {};
+
+    // The minimum and maximum of each pair of items in a and b. Every kind uses a single comparison (or is exact), so the results are always a permutation of the inputs, even for items which are unordered, e.g. NaN.
+    template <std::size_t SIZE, VectorKind KIND>
+    struct VectorMinimumMaximum;
+
+    template <>
+    struct VectorMinimumMaximum<4, VECTOR_SIGNED> {
+        __attribute__((target("avx2"), always_inline))
+        static inline void apply(__m256i a, __m256i b, __m256i & minimum, __m256i & maximum) {
+            minimum = _mm256_min_epi32(a, b);
+            maximum = _mm256_max_epi32(a, b);
+        }
+    };
+
+    template <>
+    struct VectorMinimumMaximum<4, VECTOR_UNSIGNED> {
+        __attribute__((target("avx2"), always_inline))
+        static inline void apply(__m256i a, __m256i b, __m256i & minimum, __m256i & maximum) {
+            minimum = _mm256_min_epu32(a, b);
+            maximum = _mm256_max_epu32(a, b);
+        }
+    };
+
+    template <>
+    struct VectorMinimumMaximum<4, VECTOR_FLOATING> {
+        __attribute__((target("avx2"), always_inline))
+        static inline void apply(__m256i a, __m256i b, __m256i & minimum, __m256i & maximum) {
+            __m256i less = _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(b), _mm256_castsi256_ps(a), _CMP_LT_OQ));
+
+            minimum = _mm256_blendv_epi8(a, b, less);
+            maximum = _mm256_blendv_epi8(b, a, less);
+        }
+    };
+
+    template <>
+    struct VectorMinimumMaximum<8, VECTOR_SIGNED> {
+        __attribute__((target("avx2"), always_inline))
+        static inline void apply(__m256i a, __m256i b, __m256i & minimum, __m256i & maximum) {
+            __m256i less = _mm256_cmpgt_epi64(a, b);
+
+            minimum = _mm256_blendv_epi8(a, b, less);
+            maximum = _mm256_blendv_epi8(b, a, less);
+        }
+    };
+
+    // There is no unsigned 64 bit comparison, but flipping the sign bit of both sides orders unsigned integers as signed integers.
+    template <>
+    struct VectorMinimumMaximum<8, VECTOR_UNSIGNED> {
+        __attribute__((target("avx2"), always_inline))
+        static inline void apply(__m256i a, __m256i b, __m256i & minimum, __m256i & maximum) {
+            const __m256i bias = _mm256_set1_epi64x(0x8000000000000000LL);
+            __m256i less = _mm256_cmpgt_epi64(_mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+
+            minimum = _mm256_blendv_epi8(a, b, less);
+            maximum = _mm256_blendv_epi8(b, a, less);
+        }
+    };
+
+    template <>
+    struct VectorMinimumMaximum<8, VECTOR_FLOATING> {
+        __attribute__((target("avx2"), always_inline))
+        static inline void apply(__m256i a, __m256i b, __m256i & minimum, __m256i & maximum) {
+            __m256i less = _mm256_castpd_si256(_mm256_cmp_pd(_mm256_castsi256_pd(b), _mm256_castsi256_pd(a), _CMP_LT_OQ));
+
+            minimum = _mm256_blendv_epi8(a, b, less);
+            maximum = _mm256_blendv_epi8(b, a, less);
+        }
+    };
+
+    // The bitonic merge network for each size of item: merge(a, b) takes two sorted vectors and leaves the smaller half of their items in a and the larger half in b, both sorted.
+    template <typename ValueT, std::size_t SIZE = std::is_arithmetic<ValueT>::value ? sizeof(ValueT) : 0>
+    struct BitonicNetwork {
+        static const std::size_t WIDTH = 0;
+    };
+
+    template <typename ValueT>
+    struct BitonicNetwork<ValueT, 4> {
+        typedef VectorMinimumMaximum<4, vector_kind<ValueT>::value> MinimumMaximumT;
+        typedef __m256i BlockT;
+
+        static const std::size_t WIDTH = 8;
+
+        __attribute__((target("avx2"), always_inline))
+        static inline BlockT load(const ValueT * items) {
+            return _mm256_loadu_si256((const __m256i *)items);
+        }
+
+        __attribute__((target("avx2"), always_inline))
+        static inline void store(ValueT * items, const BlockT & block) {
+            _mm256_storeu_si256((__m256i *)items, block);
+        }
+
+        __attribute__((target("avx2"), always_inline))
+        static inline void merge(__m256i & a, __m256i & b) {
+            __m256i minimum, maximum;
+
+            // Reversing b makes a and b together a bitonic sequence, and after one step, each half is bitonic and every item in the lower half is no greater than any item in the upper half.
+            b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+            MinimumMaximumT::apply(a, b, a, b);
+
+            // Then sort each half by comparing items 4, 2 and 1 apart.
+            MinimumMaximumT::apply(a, _mm256_permute2x128_si256(a, a, 0x01), minimum, maximum);
+            a = _mm256_blend_epi32(minimum, maximum, 0xF0);
+            MinimumMaximumT::apply(b, _mm256_permute2x128_si256(b, b, 0x01), minimum, maximum);
+            b = _mm256_blend_epi32(minimum, maximum, 0xF0);
+
+            MinimumMaximumT::apply(a, _mm256_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)), minimum, maximum);
+            a = _mm256_blend_epi32(minimum, maximum, 0xCC);
+            MinimumMaximumT::apply(b, _mm256_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2)), minimum, maximum);
+            b = _mm256_blend_epi32(minimum, maximum, 0xCC);
+
+            MinimumMaximumT::apply(a, _mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)), minimum, maximum);
+            a = _mm256_blend_epi32(minimum, maximum, 0xAA);
+            MinimumMaximumT::apply(b, _mm256_shuffle_epi32(b, _MM_SHUFFLE(2, 3, 0, 1)), minimum, maximum);
+            b = _mm256_blend_epi32(minimum, maximum, 0xAA);
+        }
+    };
+
+    // Each comparison of 64 bit items takes several instructions, and the larger half of every merge is needed by the next one, so merging 4 items at a time would be limited by the latency of the network. Instead, blocks of 8 items are merged using two vectors each, which takes only one more step.
+    template <typename ValueT>
+    struct BitonicNetwork<ValueT, 8> {
+        typedef VectorMinimumMaximum<8, vector_kind<ValueT>::value> MinimumMaximumT;
+
+        struct BlockT {
+            __m256i low, high;
+        };
+
+        static const std::size_t WIDTH = 8;
+
+        __attribute__((target("avx2"), always_inline))
+        static inline BlockT load(const ValueT * items) {
+            BlockT block = {_mm256_loadu_si256((const __m256i *)items), _mm256_loadu_si256((const __m256i *)(items + 4))};
+
+            return block;
+        }
+
+        __attribute__((target("avx2"), always_inline))
+        static inline void store(ValueT * items, const BlockT & block) {
+            _mm256_storeu_si256((__m256i *)items, block.low);
+            _mm256_storeu_si256((__m256i *)(items + 4), block.high);
+        }
+
+        // Sort a bitonic sequence of 8 items by comparing items 4, 2 and 1 apart.
+        __attribute__((target("avx2"), always_inline))
+        static inline void sort(__m256i & low, __m256i & high) {
+            __m256i minimum, maximum;
+
+            MinimumMaximumT::apply(low, high, low, high);
+
+            MinimumMaximumT::apply(low, _mm256_permute4x64_epi64(low, _MM_SHUFFLE(1, 0, 3, 2)), minimum, maximum);
+            low = _mm256_blend_epi32(minimum, maximum, 0xF0);
+            MinimumMaximumT::apply(high, _mm256_permute4x64_epi64(high, _MM_SHUFFLE(1, 0, 3, 2)), minimum, maximum);
+            high = _mm256_blend_epi32(minimum, maximum, 0xF0);
+
+            MinimumMaximumT::apply(low, _mm256_permute4x64_epi64(low, _MM_SHUFFLE(2, 3, 0, 1)), minimum, maximum);
+            low = _mm256_blend_epi32(minimum, maximum, 0xCC);
+            MinimumMaximumT::apply(high, _mm256_permute4x64_epi64(high, _MM_SHUFFLE(2, 3, 0, 1)), minimum, maximum);
+            high = _mm256_blend_epi32(minimum, maximum, 0xCC);
+        }
+
+        __attribute__((target("avx2"), always_inline))
+        static inline void merge(BlockT & a, BlockT & b) {
+            // As above, reversing b, and then sorting each half.
+            __m256i low = _mm256_permute4x64_epi64(b.high, _MM_SHUFFLE(0, 1, 2, 3));
+            __m256i high = _mm256_permute4x64_epi64(b.low, _MM_SHUFFLE(0, 1, 2, 3));
+
+            MinimumMaximumT::apply(a.low, low, a.low, b.low);
+            MinimumMaximumT::apply(a.high, high, a.high, b.high);
+
+            sort(a.low, a.high);
+            sort(b.low, b.high);
+        }
+    };
+
+    // Merge [left, left_end] and [right, right_end] into destination, WIDTH items at a time. After the first block, the larger half of each merge is kept in a register and merged with the next block from whichever side has the smaller next item, which is always enough to decide the next WIDTH items of the output.
+    template <typename ValueT>
+    __attribute__((target("avx2")))
+    void vector_merge(const ValueT * left, const ValueT * left_end, const ValueT * right, const ValueT * right_end, ValueT * destination) {
+        typedef BitonicNetwork<ValueT> NetworkT;
+        const std::size_t WIDTH = NetworkT::WIDTH;
+
+        if (std::size_t(left_end - left) < WIDTH || std::size_t(right_end - right) < WIDTH) {
+            branchless_merge(left, left_end, right, right_end, destination);
+            return;
+        }
+
+        typename NetworkT::BlockT lower = NetworkT::load(left), upper = NetworkT::load(right);
+        left += WIDTH, right += WIDTH;
+
+        while (true) {
+            NetworkT::merge(lower, upper);
+            NetworkT::store(destination, lower);
+            destination += WIDTH;
+
+            if (std::size_t(left_end - left) < WIDTH || std::size_t(right_end - right) < WIDTH)
+                break;
+
+            bool take_right = *right < *left;
+            const ValueT * next = take_right ? right : left;
+
+            left += take_right ? 0 : WIDTH;
+            right += take_right ? WIDTH : 0;
+
+            lower = NetworkT::load(next);
+        }
+
+        // The larger half of the last merge is still to be merged with the rest of both sides, one of which has fewer than WIDTH items left. Merge it with that side first, and then the result with the other side.
+        ValueT pending[WIDTH], merged[WIDTH * 2];
+        NetworkT::store(pending, upper);
+
+        const ValueT * pending_end = pending + WIDTH;
+
+        if (std::size_t(left_end - left) < WIDTH) {
+            const ValueT * merged_end = branchless_merge<const ValueT *>(pending, pending_end, left, left_end, merged);
+            branchless_merge<const ValueT *>(merged, merged_end, right, right_end, destination);
+        } else {
+            const ValueT * merged_end = branchless_merge<const ValueT *>(pending, pending_end, right, right_end, merged);
+            branchless_merge<const ValueT *>(left, left_end, merged, merged_end, destination);
+        }
+    }
+
+    // Returns false if the processor doesn't support the vector kernel, or there isn't one for this type of item.
+    template <typename ValueT, bool VECTOR = (BitonicNetwork<ValueT>::WIDTH > 0)>
+    struct VectorMerge {
+        static bool merge(const ValueT *, const ValueT *, const ValueT *, const ValueT *, ValueT *) {
+            return false;
+        }
+    };
+
+    template <typename ValueT>
+    struct VectorMerge<ValueT, true> {
+        static bool merge(const ValueT * left, const ValueT * left_end, const ValueT * right, const ValueT * right_end, ValueT * destination) {
+            if (!avx2_supported())
+                return false;
+
+            vector_merge(left, left_end, right, right_end, destination);
+
+            return true;
+        }
+    };
+
+    // Uses the vector kernel if both sequences are contiguous. This is decided at compile time, since other iterators can't be converted to pointers.
+    template <typename ValueT, bool CONTIGUOUS>
+    struct ContiguousMerge {
+        template <typename SourceT, typename DestinationT>
+        static bool merge(SourceT, DestinationT, std::size_t, std::size_t, std::size_t, std::size_t, std::size_t) {
+            return false;
+        }
+    };
+
+    template <typename ValueT>
+    struct ContiguousMerge<ValueT, true> {
+        template <typename SourceT, typename DestinationT>
+        static bool merge(SourceT source, DestinationT destination, std::size_t left, std::size_t left_end, std::size_t right, std::size_t right_end, std::size_t offset) {
+            if (left == left_end || right == right_end)
+                return false;
+
+            const ValueT * items = &*source;
+
+            return VectorMerge<ValueT>::merge(items + left, items + left_end, items + right, items + right_end, &*destination + offset);
+        }
+    };
+#endif
+
+    // Arithmetic items compared with std::less use the branchless or vector kernels.
+    template <typename ComparatorT, typename ValueT>
+    struct MergeKernel<ComparatorT, ValueT, true> {
+        template <typename SourceT, typename DestinationT>
+        static void merge(SourceT source, DestinationT destination, const ComparatorT &, std::size_t left, std::size_t left_end, std::size_t right, std::size_t right_end, std::size_t offset) {
+#ifdef PARALLEL_MERGE_SORT_X86
+            if (ContiguousMerge<ValueT, contiguous_iterator<SourceT>::value && contiguous_iterator<DestinationT>::value>::merge(source, destination, left, left_end, right, right_end, offset))
+                return;
+#endif
+
+            branchless_merge(source + left, source + left_end, source + right, source + right_end, destination + offset);
+        }
+    };
+
+    // As MergeKernel, but never uses the vector kernel, so that items which compare equal are always taken from the lower sequence first. See StablePolicy.
+    template <typename ComparatorT, typename ValueT, bool BRANCHLESS = std::is_arithmetic<ValueT>::value && std::is_same<ComparatorT, std::less<ValueT> >::value>
+    struct StableMergeKernel : public MergeKernel<ComparatorT, ValueT, false> {};
+
+    template <typename ComparatorT, typename ValueT>
+    struct StableMergeKernel<ComparatorT, ValueT, true> {
+        template <typename SourceT, typename DestinationT>
+        static void merge(SourceT source, DestinationT destination, const ComparatorT &, std::size_t left, std::size_t left_end, std::size_t right, std::size_t right_end, std::size_t offset) {
+            branchless_merge(source + left, source + left_end, source + right, source + right_end, destination + offset);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,253 @@
+//
+//  NumaSort.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_NumaSort_h
+#define DictionarySort_NumaSort_h
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#if PARALLEL_MERGE_SORT_LIBNUMA
+#include <numaif.h>
+#endif
+
+#include "ParallelMergeSort.h"
+
+namespace ParallelMergeSort {
+    /** NUMA Aware Parallel Merge Sort.
+
+        On a machine with several NUMA nodes, memory is placed on the node of the thread which first touches it. sort allocates its scratch buffer on the calling thread, and any worker may steal any part of the tree, so most workers merge through the memory of another node.
+
+        sort_numa gives each worker of the scheduler its own slice of the range, and the slices are ordered like the workers, so that a pinned scheduler (see Scheduler) keeps the slices of each node together:
+
+        - The top of the tree is split by worker rather than by depth. Each node forks its upper half to the first worker of the upper half of its workers, which is the only one that executes it, and sorts its lower half itself.
+        - Each worker first touches its slice of the scratch buffer before sorting it, so those pages are allocated on its node. With -DPARALLEL_MERGE_SORT_LIBNUMA=1, its slice of the array, which the caller has already written, is moved to its node with move_pages.
+        - The slice is then sorted by partition, which forks configuration.threaded more levels as tasks. With 0, each slice is sorted entirely by its worker.
+        - Each merge above the slices is split into one segment per worker of the node, and each segment is executed by the worker which owns that part of the destination.
+
+        So all of the work below the slices only touches local memory, and only the merges which combine slices from different nodes read remote memory. The allocating entry point uses a buffer which isn't written until each worker touches its own part of it, which is only the case for items which are trivially default constructible.
+
+     */
+    template <typename PolicyT, typename IteratorT, typename ScratchT, typename ComparatorT>
+    class NumaSort {
+    public:
+        NumaSort(IteratorT array, ScratchT scratch, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler)
+            : _array(array), _scratch(scratch), _comparator(comparator), _configuration(configuration), _scheduler(scheduler)
+        {
+        }
+
+        // Sort [lower_bound, upper_bound] into destination using workers [first_worker, first_worker + workers], which must include the calling thread. If in_place is true, the unsorted items are in destination, otherwise they are in source.
+        template <typename SourceT, typename DestinationT>
+        void sort(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t first_worker, std::size_t workers);
+
+        template <typename SourceT, typename DestinationT>
+        struct ParallelNumaSort {
+            NumaSort & numa_sort;
+            SourceT source;
+            DestinationT destination;
+            std::size_t lower_bound, upper_bound;
+            bool in_place;
+            std::size_t first_worker, workers;
+
+            void operator()() {
+                numa_sort.sort(source, destination, lower_bound, upper_bound, in_place, first_worker, workers);
+            }
+        };
+
+    protected:
+        IteratorT _array;
+        ScratchT _scratch;
+        const ComparatorT & _comparator;
+        const Configuration & _configuration;
+        Scheduler & _scheduler;
+
+        template <typename SourceT, typename DestinationT>
+        struct Segment {
+            ParallelMerge<SourceT, DestinationT, ComparatorT, PolicyT> & merge;
+            std::size_t begin_rank, begin_split, end_rank, end_split;
+
+            void operator()() {
+                Trace::Scope merge_scope(Trace::MERGE, merge.lower_bound + begin_rank, merge.lower_bound + end_rank, 0);
+
+                merge.merge_segment(begin_rank, begin_split, end_rank, end_split);
+            }
+        };
+
+        // Write one item in each page of [lower_bound, upper_bound] of the scratch buffer, so that the pages are allocated on the node of the calling thread. The contents of the scratch buffer are overwritten anyway.
+        void first_touch(std::size_t lower_bound, std::size_t upper_bound) {
+            typedef typename std::iterator_traits<ScratchT>::value_type ValueT;
+
+            std::size_t stride = std::max<std::size_t>(1, sysconf(_SC_PAGESIZE) / sizeof(ValueT));
+
+            for (std::size_t offset = lower_bound; offset < upper_bound; offset += stride)
+                _scratch[offset] = ValueT();
+        }
+
+#if PARALLEL_MERGE_SORT_LIBNUMA
+        // Move the pages which lie entirely within [lower_bound, upper_bound] of the array to the given node. Pages which are shared with a neighbouring slice are left where they are.
+        void move_to_node(std::size_t lower_bound, std::size_t upper_bound, int node, std::true_type) {
+            if (lower_bound == upper_bound)
+                return;
+
+            std::size_t page_size = sysconf(_SC_PAGESIZE);
+            std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(&*(_array + lower_bound));
+            std::uintptr_t end = reinterpret_cast<std::uintptr_t>(&*(_array + (upper_bound - 1)) + 1);
+
+            begin = (begin + page_size - 1) / page_size * page_size;
+            end = end / page_size * page_size;
+
+            if (begin >= end)
+                return;
+
+            std::size_t count = (end - begin) / page_size;
+            std::vector<void *> pages(count);
+            std::vector<int> nodes(count, node), status(count);
+
+            for (std::size_t i = 0; i < count; i += 1)
+                pages[i] = reinterpret_cast<void *>(begin + i * page_size);
+
+            // This is only a hint, so if it fails, e.g. because the node is out of memory, the pages stay where they are.
+            move_pages(0, count, pages.data(), nodes.data(), status.data(), MPOL_MF_MOVE);
+        }
+#endif
+
+        // Items which aren't in contiguous memory can't be moved.
+        void move_to_node(std::size_t, std::size_t, int, std::false_type) {
+        }
+
+        // Sort one worker's slice.
+        template <typename SourceT, typename DestinationT>
+        void leaf(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t worker) {
+            first_touch(lower_bound, upper_bound);
+
+#if PARALLEL_MERGE_SORT_LIBNUMA
+            move_to_node(lower_bound, upper_bound, int(_scheduler.node(worker)), contiguous_iterator<IteratorT>());
+#else
+            (void)worker;
+#endif
+
+            if (_configuration.threaded == 0) {
+                Trace::Scope partition_scope(Trace::PARTITION, lower_bound, upper_bound, 0);
+
+                partition<PolicyT>(source, destination, _comparator, lower_bound, upper_bound, in_place);
+            } else {
+                partition<PolicyT>(source, destination, _comparator, lower_bound, upper_bound, in_place, _configuration.threaded, _configuration, _scheduler);
+            }
+        }
+
+        // Merge the two halves, split into one segment per worker, each of which is executed by the worker whose slice of destination it writes.
+        template <typename SourceT, typename DestinationT>
+        void merge(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t middle_bound, std::size_t upper_bound, std::size_t first_worker, std::size_t workers) {
+            std::size_t count = upper_bound - lower_bound;
+            std::size_t segments = 1;
+
+            if (PolicyT::PARALLEL_MERGE && count > _configuration.parallel_merge_minimum_count)
+                segments = std::min(workers, count / _configuration.parallel_merge_minimum_count);
+
+            if (segments <= 1) {
+                ParallelMergeSort::merge<PolicyT>(source, destination, _comparator, lower_bound, middle_bound, upper_bound);
+                return;
+            }
+
+            ParallelMerge<SourceT, DestinationT, ComparatorT, PolicyT> parallel_merge = {source, destination, _comparator, lower_bound, middle_bound, upper_bound, 0, count, segments, _scheduler};
+
+            std::deque<Scheduler::FunctorTask<Segment<SourceT, DestinationT> > > tasks;
+            std::size_t begin_split = 0;
+
+            for (std::size_t i = 0; i < segments; i += 1) {
+                std::size_t begin_rank = count * i / segments, end_rank = count * (i+1) / segments;
+                std::size_t end_split = co_rank(source, _comparator, lower_bound, middle_bound, upper_bound, end_rank);
+
+                Segment<SourceT, DestinationT> segment = {parallel_merge, begin_rank, begin_split, end_rank, end_split};
+                tasks.emplace_back(segment);
+
+                begin_split = end_split;
+            }
+
+            _scheduler.fork_join(tasks, first_worker, workers);
+        }
+    };
+
+    template <typename PolicyT, typename IteratorT, typename ScratchT, typename ComparatorT>
+    template <typename SourceT, typename DestinationT>
+    void NumaSort<PolicyT, IteratorT, ScratchT, ComparatorT>::sort(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t first_worker, std::size_t workers) {
+        std::size_t count = upper_bound - lower_bound;
+
+        // Below one item per worker, both halves might not have items.
+        if (workers <= 1 || count < workers) {
+            leaf(source, destination, lower_bound, upper_bound, in_place, first_worker);
+            return;
+        }
+
+        Trace::Scope node_scope(Trace::NODE, lower_bound, upper_bound, workers);
+
+        // Each worker gets the same number of items, so the halves are split in proportion to their workers.
+        std::size_t lower_workers = workers / 2;
+        std::size_t middle_bound = lower_bound + count * lower_workers / workers;
+
+        ParallelNumaSort<DestinationT, SourceT> upper_numa_sort = {*this, destination, source, middle_bound, upper_bound, !in_place, first_worker + lower_workers, workers - lower_workers};
+        Scheduler::FunctorTask<ParallelNumaSort<DestinationT, SourceT> > upper_task(upper_numa_sort);
+
+        _scheduler.fork(upper_task, first_worker + lower_workers);
+        sort(destination, source, lower_bound, middle_bound, !in_place, first_worker, lower_workers);
+
+        {
+            Trace::Scope join_scope(Trace::JOIN, lower_bound, upper_bound, workers);
+            _scheduler.join(upper_task);
+        }
+
+        Trace::Scope merge_scope(Trace::MERGE, lower_bound, upper_bound, workers);
+
+        merge(source, destination, lower_bound, middle_bound, upper_bound, first_worker, workers);
+    }
+
+    /** NUMA Aware Parallel Merge Sort, main entry point.
+
+        As sort, but the range is divided into one slice per worker of the scheduler, see NumaSort. configuration.threaded gives the depth of the tree below each slice which is executed as tasks, which any worker may steal. The caller provides a scratch buffer of at least (end - begin) items, which should not have been written yet, so that each worker is the first to touch its part of it.
+
+     */
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT, typename ScratchT>
+    void sort_numa(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler, ScratchT scratch) {
+        typedef NumaSort<PolicyT, IteratorT, ScratchT, ComparatorT> NumaSortT;
+
+        std::size_t count = end - begin;
+
+        Trace::Scope sort_scope(Trace::SORT, 0, count, configuration.threaded);
+
+        NumaSortT numa_sort(begin, scratch, comparator, configuration, scheduler);
+
+        // The root of the tree runs on the first worker, even if the calling thread is not a worker.
+        typename NumaSortT::template ParallelNumaSort<ScratchT, IteratorT> root = {numa_sort, scratch, begin, 0, count, true, 0, scheduler.concurrency()};
+        Scheduler::FunctorTask<typename NumaSortT::template ParallelNumaSort<ScratchT, IteratorT> > root_task(root);
+
+        scheduler.fork(root_task, 0);
+        scheduler.join(root_task);
+    }
+
+    // As above, allocating a scratch buffer of default initialized items, which for trivial items doesn't write to the buffer.
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT>
+    void sort_numa(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        typedef typename std::iterator_traits<IteratorT>::value_type ValueT;
+
+        std::unique_ptr<ValueT[]> scratch(new ValueT[end - begin]);
+
+        sort_numa<PolicyT>(begin, end, comparator, configuration, scheduler, scratch.get());
+    }
+
+    // Sort a whole container, with each slice sorted by its own worker.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void sort_numa(ArrayT & array, const ComparatorT & comparator, Scheduler & scheduler) {
+        sort_numa<PolicyT>(array.begin(), array.end(), comparator, Configuration(0, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT), scheduler);
+    }
+}
+
+#endif
@@ -9,16 +9,26 @@
 #ifndef DictionarySort_ParallelMergeSort_h
 #define DictionarySort_ParallelMergeSort_h
 
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <vector>
 #include <thread>
+#include <type_traits>
 #include "Benchmark.h"
+#include "MergeKernel.h"
+#include "Scheduler.h"
+#include "Trace.h"
+#include "Tuning.h"
 
 // A parallel merge sort algorithm template implemented using C++0x11 threads.
 namespace ParallelMergeSort {        
     /** Parallel Merge Algorithm.
      
-         This parallel merge algorithm uses two threads and requires no synchrnoisation (e.g. lock free).
+         This parallel merge algorithm splits a merge into any number of independent segments and requires no synchronisation (e.g. lock free).
          
-         Given two sorted sequences i and j, such that |i| == |j| or |i| == |j|-1, we can merge these together by taking the |i| smallest items and |j| biggest items independently. The final sorted list q which consists of all items from i and j in order, has a basic property such that the lower |i| items in q and the upper |j| items in q are mutually exclusive. Therefore, we can select each half of the list independently:
+         Given two sorted sequences i and j, the final sorted list q which consists of all items from i and j in order has a basic property: for any k, the first k items of q are made up of the first a items of i and the first b = k - a items of j. We call a the co-rank of k. Once we know the co-rank, q[0,k] and q[k,|q|] can be formed independently by merging i[0,a] with j[0,b], and i[a,|i|] with j[b,|j|]:
          
             ij = [1, 3, 5, 2, 4, 6]
                 i = [1, 3, 5]
@@ -26,107 +36,438 @@ namespace ParallelMergeSort {
 
             q = [1, 2, 3, 4, 5, 6]
          
-         In this case, we can see that q[0,3] can be formed by merging the first 3 smallest items, and q[3,6] can be formed by merging the largest 3 items. Because these are mutually exclusive, this process can be done on two threads.
+         In this case, for k = 3, a = 2 and b = 1, so q[0,3] is formed by merging [1, 3] with [2], and q[3,6] by merging [5] with [4, 6]. Because these are mutually exclusive, this process can be done on two threads.
          
-         Other merging algorithms exist, but may require locking. Another approach worth exploring would be to form in parallel n heaps, where all items heap[k] < heap[k+1]. If the heaps can be constructed in sorted order, the destination array will naturally contain the final sorted list.
+         If we lay out i along one axis of a grid and j along the other, a sequential merge traces a path from the top left to the bottom right corner (the merge path). The co-rank of k is where this path crosses the k-th diagonal, and it can be found with a binary search along that diagonal without merging anything: a is the largest value such that i[a-1] <= j[k-a]. Choosing k = |q| * s / n for s in 0..n gives n equal sized segments, one per processor, regardless of the relative sizes of i and j.
      
      */
     
-    // This implementation assumes that if there are |i| items on the left side, there must be at least |i| items on the right side.
-    template <typename ArrayT, typename ComparatorT>
-    struct ParallelLeftMerge {
-        ArrayT & source, & destination;
-        const ComparatorT & comparator;
-        std::size_t lower_bound, middle_bound;
+    // The kernels, cutoffs and parallel strategy used by a sort, see Sort Policies below.
+    struct DefaultPolicy;
+    
+    // Compute the co-rank of rank within the merge of [lower_bound, middle_bound] and [middle_bound, upper_bound], e.g. the number of items from the lower sequence which make up the first rank items of the merged sequence. Ties are taken from the lower sequence first.
+    template <typename IteratorT, typename ComparatorT>
+    std::size_t co_rank(IteratorT source, const ComparatorT & comparator, std::size_t lower_bound, std::size_t middle_bound, std::size_t rank, std::size_t low, std::size_t high);
+    
+    template <typename IteratorT, typename ComparatorT>
+    std::size_t co_rank(IteratorT source, const ComparatorT & comparator, std::size_t lower_bound, std::size_t middle_bound, std::size_t upper_bound, std::size_t rank) {
+        std::size_t lower_count = middle_bound - lower_bound;
+        std::size_t upper_count = upper_bound - middle_bound;
         
-        void operator()() {
-            std::size_t left = lower_bound;
-            std::size_t right = middle_bound;
-            std::size_t offset = lower_bound;
+        // The co-rank must leave no more than upper_count items to be taken from the upper sequence.
+        std::size_t low = rank > upper_count ? rank - upper_count : 0;
+        std::size_t high = rank < lower_count ? rank : lower_count;
+        
+        return co_rank(source, comparator, lower_bound, middle_bound, rank, low, high);
+    }
+    
+    // As above, given that the co-rank is known to be within [low, high]. Only the items source[lower_bound + low, lower_bound + high] and source[middle_bound + rank - high, middle_bound + rank - low] are compared.
+    template <typename IteratorT, typename ComparatorT>
+    std::size_t co_rank(IteratorT source, const ComparatorT & comparator, std::size_t lower_bound, std::size_t middle_bound, std::size_t rank, std::size_t low, std::size_t high) {
+        // Find the largest a such that source[lower_bound + a - 1] <= source[middle_bound + rank - a]. This property holds trivially for low, and is monotonic in a.
+        while (low < high) {
+            std::size_t a = (low + high + 1) / 2;
             
-            while (offset < middle_bound) {
-                if (comparator(source[left], source[right])) {
-                    destination[offset++] = source[left++];
-                } else {
-                    destination[offset++] = source[right++];
-                }
+            if (comparator(source[middle_bound + rank - a], source[lower_bound + a - 1])) {
+                high = a - 1;
+            } else {
+                low = a;
             }
         }
-    };
+        
+        return low;
+    }
     
-    // This implementation assumes that if there are |j| items on the right side, there are at least |j| - 1 items on the left side.
-    template <typename ArrayT, typename ComparatorT>
-    struct ParallelRightMerge {
-        ArrayT & source, & destination;
+    // This functor merges a range of ranks [begin_rank, end_rank] of the merged output. If there is more than one segment, it recursively splits the range in half, forking the upper half onto the scheduler.
+    template <typename SourceT, typename DestinationT, typename ComparatorT, typename PolicyT = DefaultPolicy>
+    struct ParallelMerge {
+        SourceT source;
+        DestinationT destination;
         const ComparatorT & comparator;
         std::size_t lower_bound, middle_bound, upper_bound;
+        std::size_t begin_rank, end_rank, segments;
+        Scheduler & scheduler;
+        
+        // A range of ranks along with their co-ranks.
+        struct Segment {
+            ParallelMerge & merge;
+            std::size_t begin_rank, begin_split, end_rank, end_split, segments;
+            
+            void operator()() {
+                merge.split(begin_rank, begin_split, end_rank, end_split, segments);
+            }
+        };
         
         void operator()() {
-            std::size_t left = middle_bound-1;
-            std::size_t right = upper_bound-1;
-            std::size_t offset = upper_bound-1;
+            std::size_t begin_split = co_rank(source, comparator, lower_bound, middle_bound, upper_bound, begin_rank);
+            std::size_t end_split = co_rank(source, comparator, lower_bound, middle_bound, upper_bound, end_rank);
             
-            while (offset >= middle_bound) {
-                if (comparator(source[left], source[right])) {
-                    destination[offset--] = source[right--];
-                } else {
-                    destination[offset--] = source[left--];
-                    if (left == lower_bound) {
-                        // There are no more items on left hand side - in this case, there is at most one more item on right side to copy.
-                        if (offset >= middle_bound) {
-                            destination[offset] = source[right];
-                        }
-                        
-                        break;
-                    }
-                }
+            split(begin_rank, begin_split, end_rank, end_split, segments);
+        }
+        
+        // Items are moved out of source as they are merged, so a segment may only compare the items which it merges itself. The co-rank of split_rank is bounded by the co-ranks of begin_rank and end_rank, which keeps the search within the segment.
+        void split(std::size_t begin_rank, std::size_t begin_split, std::size_t end_rank, std::size_t end_split, std::size_t segments) {
+            if (segments > 1) {
+                std::size_t lower_segments = segments / 2;
+                std::size_t split_rank = begin_rank + (end_rank - begin_rank) * lower_segments / segments;
+                
+                std::size_t low = std::max(begin_split, end_split - std::min(end_split, end_rank - split_rank));
+                std::size_t high = std::min(end_split, begin_split + (split_rank - begin_rank));
+                std::size_t split_split = co_rank(source, comparator, lower_bound, middle_bound, split_rank, low, high);
+                
+                Segment upper_segment = {*this, split_rank, split_split, end_rank, end_split, segments - lower_segments};
+                Scheduler::FunctorTask<Segment> upper_task(upper_segment);
+                
+                scheduler.fork(upper_task);
+                split(begin_rank, begin_split, split_rank, split_split, lower_segments);
+                
+                Trace::Scope join_scope(Trace::JOIN, lower_bound + begin_rank, lower_bound + end_rank, 0);
+                scheduler.join(upper_task);
+            } else if (end_rank - begin_rank < upper_bound - lower_bound) {
+                // Each segment of a larger merge is traced, to show how the merge was spread over the workers.
+                Trace::Scope merge_scope(Trace::MERGE, lower_bound + begin_rank, lower_bound + end_rank, 0);
+                merge_segment(begin_rank, begin_split, end_rank, end_split);
+            } else {
+                merge_segment(begin_rank, begin_split, end_rank, end_split);
             }
         }
+        
+        void merge_segment(std::size_t begin_rank, std::size_t begin_split, std::size_t end_rank, std::size_t end_split) {
+            std::size_t left = lower_bound + begin_split, left_end = lower_bound + end_split;
+            std::size_t right = middle_bound + (begin_rank - begin_split), right_end = middle_bound + (end_rank - end_split);
+            std::size_t offset = lower_bound + begin_rank;
+            
+            // If this segment of the two sub-sequences is already in order, the merge is just a move. Either side of the segment may be empty.
+            if (left == left_end || right == right_end || !comparator(source[right], source[left_end-1])) {
+                std::move(source + left, source + left_end, destination + offset);
+                std::move(source + right, source + right_end, destination + offset + (left_end - left));
+                return;
+            }
+            
+            PolicyT::template MergeKernelT<ComparatorT, typename std::iterator_traits<SourceT>::value_type>::merge(source, destination, comparator, left, left_end, right, right_end, offset);
+        }
     };
     
-    // Merge two sorted sub-sequences sequentially (from left to right).
-    template <typename ArrayT, typename ComparatorT>
-    void merge (ArrayT & source, ArrayT & destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t middle_bound, std::size_t upper_bound) {
+    // Merge two sorted sub-sequences sequentially (from left to right). The sub-sequences are only treated as already in order if the first item of the upper one is not less than the last item of the lower one, so equal items keep their relative order whenever the kernel takes ties from the left first.
+    template <typename PolicyT = DefaultPolicy, typename SourceT, typename DestinationT, typename ComparatorT>
+    void merge (SourceT source, DestinationT destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t middle_bound, std::size_t upper_bound) {
         std::size_t left = lower_bound;
         std::size_t right = middle_bound;
         std::size_t offset = lower_bound;
         
+        // If the sub-sequences are already in order, e.g. they are part of the same ascending run, the merge is just a copy. This costs one comparison.
+        if (!comparator(source[middle_bound], source[middle_bound-1])) {
+            std::move(source + lower_bound, source + upper_bound, destination + offset);
+            return;
+        }
+        
         // We merge both sub-sequences, defined as [lower_bound, middle_bound] and [middle_bound, upper_bound].
-        while (true) {
-            if (comparator(source[left], source[right])) {
-                destination[offset++] = source[left++];
+        PolicyT::template MergeKernelT<ComparatorT, typename std::iterator_traits<SourceT>::value_type>::merge(source, destination, comparator, left, middle_bound, right, upper_bound, offset);
+    }
+    
+    // Merge two sorted sub-sequences sequentially, first trimming the prefix of the lower sequence and the suffix of the upper sequence which are already in place. This costs two binary searches, but nearly sorted sequences (e.g. a sorted list with a few items appended) only merge the items which overlap.
+    template <typename PolicyT = DefaultPolicy, typename SourceT, typename DestinationT, typename ComparatorT>
+    void gallop_merge (SourceT source, DestinationT destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t middle_bound, std::size_t upper_bound) {
+        if (!comparator(source[middle_bound], source[middle_bound-1])) {
+            std::move(source + lower_bound, source + upper_bound, destination + lower_bound);
+            return;
+        }
+        
+        // Items in the lower sequence which are not greater than the first item of the upper sequence come first.
+        std::size_t merge_lower_bound = std::upper_bound(source + lower_bound, source + middle_bound, source[middle_bound], comparator) - source;
+        
+        // Items in the upper sequence which are not less than the last item of the lower sequence come last.
+        std::size_t merge_upper_bound = std::lower_bound(source + middle_bound, source + upper_bound, source[middle_bound-1], comparator) - source;
+        
+        std::move(source + lower_bound, source + merge_lower_bound, destination + lower_bound);
+        std::move(source + merge_upper_bound, source + upper_bound, destination + merge_upper_bound);
+        
+        // Because the sub-sequences were not in order, both [merge_lower_bound, middle_bound] and [middle_bound, merge_upper_bound] contain at least one item.
+        merge<PolicyT>(source, destination, comparator, merge_lower_bound, middle_bound, merge_upper_bound);
+    }
+    
+    /** Natural Runs.
+     
+        Many inputs are already mostly sorted, or are a sorted list with a few items appended. Before sorting, we scan the input for runs which are ascending, or strictly descending. Descending runs are reversed in place (strictly descending, so that reversing them doesn't reorder equal items), and every run of at least MINIMUM_RUN_COUNT items is recorded.
+     
+        During partition, any part of the tree which falls entirely within a run is already sorted, so we skip it without comparing anything. Merges use gallop_merge, so that the parts of two sub-sequences which are already in place are copied rather than merged. A sorted input costs a single scan, and a sorted input with k items appended costs about O(n + k log n).
+     
+        The scan is split into chunks which are scanned in parallel. Runs which cross a chunk boundary are joined afterwards if they are in order.
+     
+     */
+    class Runs {
+    public:
+        // Shorter runs are not worth recording, as the base case will sort them quickly anyway.
+        static const std::size_t MINIMUM_RUN_COUNT = 64;
+        
+        struct Run {
+            std::size_t lower_bound, upper_bound;
+        };
+        
+        const std::vector<Run> & runs() const { return _runs; }
+        
+        // Whether [lower_bound, upper_bound] falls within a single ascending run.
+        bool sorted(std::size_t lower_bound, std::size_t upper_bound) const {
+            // Find the last run which starts at or before lower_bound:
+            std::size_t low = 0, high = _runs.size();
+            
+            while (low < high) {
+                std::size_t middle = (low + high) / 2;
                 
-                // If we have adjusted left, we may have exhausted left side:
-                if (left == middle_bound) {
-                    // We have no more elements in lower half.
-                    std::copy(source.begin() + right, source.begin() + upper_bound, destination.begin() + offset);
-                    break;
+                if (_runs[middle].lower_bound <= lower_bound)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+            
+            return low > 0 && _runs[low-1].upper_bound >= upper_bound;
+        }
+        
+        // Sequentially scan [lower_bound, upper_bound] of the array for runs, reversing descending runs in place.
+        template <typename IteratorT, typename ComparatorT>
+        void scan(IteratorT array, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound) {
+            std::size_t offset = lower_bound;
+            
+            while (offset < upper_bound) {
+                std::size_t run_lower_bound = offset;
+                offset += 1;
+                
+                if (offset < upper_bound && comparator(array[offset], array[offset-1])) {
+                    while (offset < upper_bound && comparator(array[offset], array[offset-1]))
+                        offset += 1;
+                    
+                    if (offset - run_lower_bound >= MINIMUM_RUN_COUNT)
+                        std::reverse(array + run_lower_bound, array + offset);
+                } else {
+                    while (offset < upper_bound && !comparator(array[offset], array[offset-1]))
+                        offset += 1;
                 }
-            } else {
-                destination[offset++] = source[right++];
                 
-                // As above, we may have exhausted right side:
-                if (right == upper_bound) {
-                    // We have no more elements in upper half.
-                    std::copy(source.begin() + left, source.begin() + middle_bound, destination.begin() + offset);
-                    break;
+                if (offset - run_lower_bound >= MINIMUM_RUN_COUNT) {
+                    Run run = {run_lower_bound, offset};
+                    _runs.push_back(run);
+                }
+            }
+        }
+        
+        // Append runs from another scan, which must cover a later part of the same array. If the two scans meet at adjacent runs which are in order, they are joined.
+        template <typename IteratorT, typename ComparatorT>
+        void append(const Runs & other, IteratorT array, const ComparatorT & comparator) {
+            typename std::vector<Run>::const_iterator next = other._runs.begin();
+            
+            if (!_runs.empty() && next != other._runs.end()) {
+                Run & last = _runs.back();
+                
+                if (last.upper_bound == next->lower_bound && !comparator(array[next->lower_bound], array[last.upper_bound-1])) {
+                    last.upper_bound = next->upper_bound;
+                    ++next;
                 }
             }
-        }        
+            
+            _runs.insert(_runs.end(), next, other._runs.end());
+        }
+        
+        // Scan [0, count] of the array for runs, using up to the given number of chunks in parallel.
+        template <typename IteratorT, typename ComparatorT>
+        void find(IteratorT array, std::size_t count, const ComparatorT & comparator, std::size_t chunks, Scheduler & scheduler);
+        
+    protected:
+        // Ordered, non-overlapping runs.
+        std::vector<Run> _runs;
+    };
+    
+    template <typename IteratorT, typename ComparatorT>
+    struct ParallelScan : public Scheduler::Task {
+        IteratorT array;
+        const ComparatorT & comparator;
+        std::size_t lower_bound, upper_bound;
+        Runs runs;
+        
+        ParallelScan(IteratorT _array, const ComparatorT & _comparator, std::size_t _lower_bound, std::size_t _upper_bound)
+            : array(_array), comparator(_comparator), lower_bound(_lower_bound), upper_bound(_upper_bound)
+        {
+        }
+        
+        virtual void execute() {
+            runs.scan(array, comparator, lower_bound, upper_bound);
+        }
+    };
+    
+    template <typename IteratorT, typename ComparatorT>
+    void Runs::find(IteratorT array, std::size_t count, const ComparatorT & comparator, std::size_t chunks, Scheduler & scheduler) {
+
+        // Each chunk should contain at least a few runs.
+        chunks = std::max<std::size_t>(1, std::min(chunks, count / (MINIMUM_RUN_COUNT * 16)));
+        
+        std::deque<ParallelScan<IteratorT, ComparatorT> > scans;
+        
+        for (std::size_t i = 0; i < chunks; i += 1) {
+            scans.emplace_back(array, comparator, count * i / chunks, count * (i+1) / chunks);
+        }
+        
+        scheduler.fork_join(scans);
+        _runs.swap(scans[0].runs._runs);
+        
+        for (std::size_t i = 1; i < chunks; i += 1) {
+            append(scans[i].runs, array, comparator);
+        }
     }
     
-    template <typename ArrayT, typename ComparatorT>
-    void partition(ArrayT & array, ArrayT & temporary, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound, std::size_t threaded);
+    template <typename PolicyT = DefaultPolicy, typename SourceT, typename DestinationT, typename ComparatorT>
+    void partition(SourceT source, DestinationT destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t threaded, const Configuration & configuration, Scheduler & scheduler, const Runs * runs = 0);
     
     // This functor is used for parallelizing the top level partition function.
-    template <typename ArrayT, typename ComparatorT>
+    template <typename SourceT, typename DestinationT, typename ComparatorT, typename PolicyT = DefaultPolicy>
     struct ParallelPartition {
-        ArrayT & array, & temporary;
+        SourceT source;
+        DestinationT destination;
         const ComparatorT & comparator;
-        std::size_t lower_bound, upper_bound, threaded;
+        std::size_t lower_bound, upper_bound;
+        bool in_place;
+        std::size_t threaded;
+        const Configuration & configuration;
+        Scheduler & scheduler;
+        const Runs * runs;
         
         void operator()() {
-            partition(array, temporary, comparator, lower_bound, upper_bound, threaded);
+            partition<PolicyT>(source, destination, comparator, lower_bound, upper_bound, in_place, threaded, configuration, scheduler, runs);
+        }
+    };
+    
+    /** Base Case Kernels.
+     
+        Splitting a partition all the way down to individual items costs a function call and a merge for every pair of items. Below BASE_CASE_MAXIMUM_COUNT items, it is faster to sort the partition directly. The kernel sorts the items in place wherever they are, and then partition moves them into destination if that is where the parity scheme expects the result.
+     
+        The kernel is chosen by BaseCase<ComparatorT, ValueT>:
+        
+            - Arithmetic keys compared with std::less use a sorting network. Every compare-exchange is a min and max which the compiler implements with conditional moves, so there are no unpredictable branches.
+            - Everything else uses binary insertion sort, which minimises the number of comparisons, e.g. for expensive comparators like CompareWordsAscending.
+     
+     */
+    
+    // Partitions with this many items or fewer are sorted directly using binary insertion sort.
+    const std::size_t BASE_CASE_MAXIMUM_COUNT = 16;
+    
+    // Sorting networks are provided for up to this many items.
+    const std::size_t SORTING_NETWORK_MAXIMUM_COUNT = 8;
+    
+    // Sort [lower_bound, upper_bound] of array in place. Equal items retain their relative order.
+    template <typename IteratorT, typename ComparatorT>
+    void insertion_sort(IteratorT array, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound) {
+        typedef typename std::iterator_traits<IteratorT>::value_type ValueT;
+        
+        for (std::size_t offset = lower_bound + 1; offset < upper_bound; offset += 1) {
+            // Items which are already in order (e.g. ascending runs) cost a single comparison.
+            if (!comparator(array[offset], array[offset-1]))
+                continue;
+            
+            ValueT value = std::move(array[offset]);
+            
+            // Find the first item in [lower_bound, offset-1] which is greater than value. We already know that array[offset-1] is.
+            std::size_t low = lower_bound, high = offset - 1;
+            while (low < high) {
+                std::size_t middle = (low + high) / 2;
+                
+                if (comparator(value, array[middle]))
+                    high = middle;
+                else
+                    low = middle + 1;
+            }
+            
+            std::move_backward(array + low, array + offset, array + offset + 1);
+            array[low] = std::move(value);
+        }
+    }
+    
+    // Branchless compare-exchange: afterwards, a <= b.
+    template <typename ValueT>
+    inline void compare_exchange(ValueT & a, ValueT & b) {
+        ValueT x = a, y = b;
+        
+        a = (y < x) ? y : x;
+        b = (y < x) ? x : y;
+    }
+    
+    // Sort [lower_bound, upper_bound] of array in place using an optimal sorting network (Knuth, TAOCP Vol. 3, 5.3.4), for up to SORTING_NETWORK_MAXIMUM_COUNT items.
+    template <typename IteratorT>
+    void network_sort(IteratorT array, std::size_t lower_bound, std::size_t upper_bound) {
+        typedef typename std::iterator_traits<IteratorT>::value_type ValueT;
+        
+        // Work on a local copy so that the compiler can keep every item in a register.
+        ValueT v[SORTING_NETWORK_MAXIMUM_COUNT];
+        std::size_t count = upper_bound - lower_bound;
+        
+        std::copy(array + lower_bound, array + upper_bound, v);
+        
+        switch (count) {
+            case 2:
+                compare_exchange(v[0], v[1]);
+                break;
+            case 3:
+                compare_exchange(v[1], v[2]); compare_exchange(v[0], v[2]); compare_exchange(v[0], v[1]);
+                break;
+            case 4:
+                compare_exchange(v[0], v[1]); compare_exchange(v[2], v[3]);
+                compare_exchange(v[0], v[2]); compare_exchange(v[1], v[3]);
+                compare_exchange(v[1], v[2]);
+                break;
+            case 5:
+                compare_exchange(v[0], v[1]); compare_exchange(v[3], v[4]);
+                compare_exchange(v[2], v[4]);
+                compare_exchange(v[2], v[3]); compare_exchange(v[1], v[4]);
+                compare_exchange(v[0], v[3]);
+                compare_exchange(v[0], v[2]); compare_exchange(v[1], v[3]);
+                compare_exchange(v[1], v[2]);
+                break;
+            case 6:
+                compare_exchange(v[1], v[2]); compare_exchange(v[4], v[5]);
+                compare_exchange(v[0], v[2]); compare_exchange(v[3], v[5]);
+                compare_exchange(v[0], v[1]); compare_exchange(v[3], v[4]); compare_exchange(v[2], v[5]);
+                compare_exchange(v[0], v[3]); compare_exchange(v[1], v[4]);
+                compare_exchange(v[2], v[4]); compare_exchange(v[1], v[3]);
+                compare_exchange(v[2], v[3]);
+                break;
+            case 7:
+                compare_exchange(v[1], v[2]); compare_exchange(v[3], v[4]); compare_exchange(v[5], v[6]);
+                compare_exchange(v[0], v[2]); compare_exchange(v[3], v[5]); compare_exchange(v[4], v[6]);
+                compare_exchange(v[0], v[1]); compare_exchange(v[4], v[5]); compare_exchange(v[2], v[6]);
+                compare_exchange(v[0], v[4]); compare_exchange(v[1], v[5]);
+                compare_exchange(v[0], v[3]); compare_exchange(v[2], v[5]);
+                compare_exchange(v[1], v[3]); compare_exchange(v[2], v[4]);
+                compare_exchange(v[2], v[3]);
+                break;
+            case 8:
+                compare_exchange(v[0], v[2]); compare_exchange(v[1], v[3]); compare_exchange(v[4], v[6]); compare_exchange(v[5], v[7]);
+                compare_exchange(v[0], v[4]); compare_exchange(v[1], v[5]); compare_exchange(v[2], v[6]); compare_exchange(v[3], v[7]);
+                compare_exchange(v[0], v[1]); compare_exchange(v[2], v[3]); compare_exchange(v[4], v[5]); compare_exchange(v[6], v[7]);
+                compare_exchange(v[2], v[4]); compare_exchange(v[3], v[5]);
+                compare_exchange(v[1], v[4]); compare_exchange(v[3], v[6]);
+                compare_exchange(v[1], v[2]); compare_exchange(v[3], v[4]); compare_exchange(v[5], v[6]);
+                break;
+        }
+        
+        std::copy(v, v + count, array + lower_bound);
+    }
+    
+    // The default base case uses binary insertion sort.
+    template <typename ComparatorT, typename ValueT, bool NETWORK = std::is_arithmetic<ValueT>::value && std::is_same<ComparatorT, std::less<ValueT> >::value>
+    struct BaseCase {
+        static const std::size_t MAXIMUM_COUNT = BASE_CASE_MAXIMUM_COUNT;
+        
+        template <typename IteratorT>
+        static void sort(IteratorT array, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound) {
+            insertion_sort(array, comparator, lower_bound, upper_bound);
+        }
+    };
+    
+    // Arithmetic keys compared with std::less use sorting networks.
+    template <typename ComparatorT, typename ValueT>
+    struct BaseCase<ComparatorT, ValueT, true> {
+        static const std::size_t MAXIMUM_COUNT = SORTING_NETWORK_MAXIMUM_COUNT;
+        
+        template <typename IteratorT>
+        static void sort(IteratorT array, const ComparatorT &, std::size_t lower_bound, std::size_t upper_bound) {
+            network_sort(array, lower_bound, upper_bound);
         }
     };
     
@@ -134,144 +475,325 @@ namespace ParallelMergeSort {
      
         This algorithm uses O(2n) memory to reduce the amount of copies that occurs. It does this by using a parity such that at each point in the partition tree we provide a source and destination. Given the functions P (partition) and M (merge), we have the following theorem:
         
-        P(A=source, B=destination) sorts source into destination. A=[...] means that we are considering only a subset of A. Subscript is not given, but should be intuitive given the definition of merge sort. (x) on the left gives the order of each step as performed sequentially.
+        P(S=source, D=destination) sorts the items into destination. The unsorted items are always in the array being sorted, which is destination at the top of the tree (in place) and alternates between destination and source at each level below. S=[...] means that we are considering only a subset of S, and ? is an item in the scratch buffer which has not been written yet. (x) on the left gives the order of each step as performed sequentially.
      
-                == [ PARTITION ] ==                     == [ MERGE ] ==
+                == [ PARTITION ] ==                              == [ MERGE ] ==
          
-            (1) P(A=[1,3,4,2], B=[1,3,2,4])        (14) M(A=[1,3,2,4], B): B = [1,2,3,4]
+            (1) P(S=[?,?,?,?], D=[1,3,4,2]) in place         (10) M(S=[1,3,2,4], D): D = [1,2,3,4]
                 |
-            (2) |---P(B=[1,3], A=[1,3])             (7) M(B=[1,3], A): A=[1,3]
+            (2) |---P(S=[1,3], D=[?,?])                       (5) M(S=[1,3], D): D = [1,3]
                 |   |
-            (3) |   |---P(A=[1], B=[1])             (4) M(A=[1], B): B=[1]
-            (5) |   \---P(A=[3], B=[3])             (6) M(A=[3], B): B=[3]
+            (3) |   |---P(S=[?], D=[1]) in place
+            (4) |   \---P(S=[?], D=[3]) in place
                 |
-            (8) \---P(B=[4,2], A=[4,2])            (13) M(B=[4,2], A): A = [2,4]
+            (6) \---P(S=[4,2], D=[?,?])                       (9) M(S=[4,2], D): D = [2,4]
                     |
-            (9)     |---P(A=[4],B=[4])             (10) M(A=[4], B): B=[4]
-           (11)     \---P(A=[2],B=[2])             (12) M(A=[2], B): B=[2]
+            (7)     |---P(S=[?], D=[4]) in place
+            (8)     \---P(S=[?], D=[2]) in place
          
-         During merge, we fold back up, and alternate between A and B for the current storage. This avoids the need to dynamically allocate memory during sort and avoids unnecessary copies.
+         During merge, we fold back up, and alternate between the array and the scratch buffer for the current storage. This avoids the need to dynamically allocate memory during sort, and every level moves each item exactly once. Because the scratch buffer never needs to contain a copy of the input, it only has to be allocated, and items are only ever moved, never copied.
+         
+         At the bottom of the tree, the base case sorts the items where they are. If they are not in place, they are then moved into destination.
      
      */
     
-    // Sequential partition algorithm. Provide an array, and an upper and lower bound to sort.
-    template <typename ArrayT, typename ComparatorT>
-    void partition(ArrayT & source, ArrayT & destination, const ComparatorT & comparator, const std::size_t & lower_bound, const std::size_t & upper_bound) {
+    // Sequential partition algorithm. Sorts [lower_bound, upper_bound] into destination. If in_place is true, the unsorted items are in destination, otherwise they are in source. If runs are given, parts of the array which are already sorted are skipped.
+    template <typename PolicyT = DefaultPolicy, typename SourceT, typename DestinationT, typename ComparatorT>
+    void partition(SourceT source, DestinationT destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound, bool in_place, const Runs * runs = 0) {
+        typedef typename PolicyT::template BaseCaseT<ComparatorT, typename std::iterator_traits<DestinationT>::value_type> BaseCaseT;
+        
         std::size_t count = upper_bound - lower_bound;
+        bool sorted = runs && runs->sorted(lower_bound, upper_bound);
         
-        // In the case where count == 1, we are at the very bottom of the tree and both source and destination will be the same.
-        // The same applies when count == 2, but we might need to swap the items around if they are not in the right order.
-        if (count == 2) {
-            if (!comparator(destination[lower_bound], destination[lower_bound+1])) {
-                std::swap(destination[lower_bound], destination[lower_bound+1]);
+        if (sorted || count <= BaseCaseT::MAXIMUM_COUNT) {
+            if (in_place) {
+                if (!sorted)
+                    BaseCaseT::sort(destination, comparator, lower_bound, upper_bound);
+            } else {
+                if (!sorted)
+                    BaseCaseT::sort(source, comparator, lower_bound, upper_bound);
+                
+                std::move(source + lower_bound, source + upper_bound, destination + lower_bound);
             }
-            // After this point, where count > 2, source and destination are different.
-        } else if (count > 2) {
+        } else {
             std::size_t middle_bound = (lower_bound + upper_bound) / 2;
-                        
-            // While it is possible to simply call partition, we try to avoid recursion by folding up the bottom two cases:
-            //  (count == 1), do nothing
-            //  (count == 2), swap if order is not correct
-            //  (count > 2), partition            
-            // After profilling, I found that the benefit of unrolling (count == 2) was minimal - there was about a 2-3% improvement.
-
-            std::size_t lower_count = middle_bound - lower_bound;
-            if (lower_count > 1)
-                partition(destination, source, comparator, lower_bound, middle_bound);
             
-            std::size_t upper_count = upper_bound - middle_bound;            
-            if (upper_count > 1)
-                partition(destination, source, comparator, middle_bound, upper_bound);
+            partition<PolicyT>(destination, source, comparator, lower_bound, middle_bound, !in_place, runs);
+            partition<PolicyT>(destination, source, comparator, middle_bound, upper_bound, !in_place, runs);
             
-            merge(source, destination, comparator, lower_bound, middle_bound, upper_bound);
+            if (runs)
+                gallop_merge<PolicyT>(source, destination, comparator, lower_bound, middle_bound, upper_bound);
+            else
+                merge<PolicyT>(source, destination, comparator, lower_bound, middle_bound, upper_bound);
         }
     }
     
     /** Parallel Partition Algorithm
      
-        This parallel partition algorithm which controls the downward descent of the merge sort algorithm is designed for large datasets. Because merge sort follows a binary tree structure, the work is essentially split between two threads at each node in the tree. Firstly, we must recursively call partition on two separate threads. Once this is done, we have two ascending sequences, and we merge these together, again using two threads, one for left sequence and one for right sequence.
+        This parallel partition algorithm which controls the downward descent of the merge sort algorithm is designed for large datasets. Because merge sort follows a binary tree structure, the work is essentially split between two tasks at each node in the tree. Firstly, we fork the upper partition onto the scheduler and partition the lower half on the current thread. Once both are done, we have two ascending sequences, and we merge these together, splitting the merge into one segment per worker using the merge path.
      
-        Because higher level threads will be waiting on lower level threads, the value of threaded should be equal to 2^threaded == processors for best performance.
+        Joining a task executes other queued tasks rather than blocking, so higher levels of the tree no longer tie up a thread while waiting on lower levels. 2^threaded should still be at least the number of processors, so that there are enough tasks to keep every worker busy.
      
      */
     
-    // Use this to control whether parallal partition is used.
+    // The default for DefaultPolicy::PARALLEL_PARTITION, which controls whether parallel partition is used.
     // For large data sets > 500_000 items, you will see an improvement of about ~50% per thread.
     const bool PARALLEL_PARTITION = true;
     
-    // Use this to control whether parallel merge is used. 
+    // The default for DefaultPolicy::PARALLEL_MERGE, which controls whether parallel merge is used.
     // For large data sets > 1_000_000 items, you will see an improvement of about 15%.
     const bool PARALLEL_MERGE = true;
     
-    // If you make this number too small, e.g. <= 2, you may cause synchronsation issues, because you will force parallelisation
-    // for base cases which actually need to be sequential to ensure that comparison cache is generated correctly.
+    // This is the default merge cutoff. Smaller merges are not worth splitting into segments, but any cutoff of at least 1 is correct, because comparators must be safe to call from multiple threads at the same time.
     const std::size_t PARALLEL_MERGE_MINIMUM_COUNT = 128;
     
-    // Provide an array, and an upper and lower bound, along with the number of threads to use.
-    template <typename ArrayT, typename ComparatorT>
-    void partition(ArrayT & source, ArrayT & destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound, std::size_t threaded) {
+    /** Sort Policies.
+     
+        The constants above apply to every sort in the process. Instead, each entry point takes a policy type as its first template argument, which selects the base case and merge kernels, the default cutoffs and the parallel strategy at compile time:
+     
+            ParallelMergeSort::sort<ParallelMergeSort::StablePolicy>(array, comparator);
+     
+        Each policy instantiates its own partition tree, so the compiler can specialise and inline it, and the branches on options which are turned off compile away. One binary can use different policies at different call sites, e.g. a sequential policy for small latency sensitive sorts alongside the default for large batch sorts. Calls which don't give a policy use DefaultPolicy, which behaves exactly as before.
+     
+        To change some of the options, derive from DefaultPolicy and hide the members to change:
+     
+            struct SequentialPolicy : public ParallelMergeSort::DefaultPolicy {
+                static const bool PARALLEL_PARTITION = false;
+                static const bool PARALLEL_MERGE = false;
+            };
+     
+        The base case kernel also gives the base case cutoff, as BaseCaseT<...>::MAXIMUM_COUNT. The cutoffs for forking tasks are the defaults for configurations which the entry points create, e.g. when given threaded rather than a Configuration.
+     
+     */
+    struct DefaultPolicy {
+        // Whether items which compare equal keep their relative order. This describes the kernels, so a policy which sets it must also choose kernels which take ties from the lower sequence first, as StablePolicy does.
+        static const bool STABLE = false;
+    
+        static const bool PARALLEL_PARTITION = ParallelMergeSort::PARALLEL_PARTITION;
+        static const bool PARALLEL_MERGE = ParallelMergeSort::PARALLEL_MERGE;
+    
+        static const std::size_t PARALLEL_PARTITION_MINIMUM_COUNT = 0;
+        static const std::size_t PARALLEL_MERGE_MINIMUM_COUNT = ParallelMergeSort::PARALLEL_MERGE_MINIMUM_COUNT;
+    
+        template <typename ComparatorT, typename ValueT>
+        using BaseCaseT = BaseCase<ComparatorT, ValueT>;
+    
+        template <typename ComparatorT, typename ValueT>
+        using MergeKernelT = MergeKernel<ComparatorT, ValueT>;
+    };
+    
+    // Sorting networks and the vector merge kernel may reorder arithmetic items which compare equal, e.g. -0.0 and 0.0. This policy uses binary insertion sort and the branchless merge kernel instead, so that the sort is stable for any items.
+    struct StablePolicy : public DefaultPolicy {
+        static const bool STABLE = true;
+    
+        template <typename ComparatorT, typename ValueT>
+        using BaseCaseT = BaseCase<ComparatorT, ValueT, false>;
+    
+        template <typename ComparatorT, typename ValueT>
+        using MergeKernelT = StableMergeKernel<ComparatorT, ValueT>;
+    };
+    
+    // As above, along with the depth of the tree to parallelise, the cutoffs for forking tasks and the scheduler to run tasks on.
+    template <typename PolicyT, typename SourceT, typename DestinationT, typename ComparatorT>
+    void partition(SourceT source, DestinationT destination, const ComparatorT & comparator, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t threaded, const Configuration & configuration, Scheduler & scheduler, const Runs * runs) {
         std::size_t count = upper_bound - lower_bound;
         
-        if (count > 1) {
+        // Sorted runs which are not in place are split further, so that they are moved into destination by parallel merges.
+        if (runs && in_place && runs->sorted(lower_bound, upper_bound))
+            return;
+        
+        Trace::Scope node_scope(Trace::NODE, lower_bound, upper_bound, threaded);
+        
+        if (count <= 1) {
+            partition<PolicyT>(source, destination, comparator, lower_bound, upper_bound, in_place);
+        } else {
             std::size_t middle_bound = (lower_bound + upper_bound) / 2;
             
-            //Benchmark::WallTime tp;
-            if (PARALLEL_PARTITION && threaded > 0) {
-                // We could check whether there is any work to do before creating threads, but we assume
-                // that threads will only be created high up in the tree by default, so there *should*
-                // be a significant work available per-thread.
-                ParallelPartition<ArrayT, ComparatorT> 
-                    lower_partition = {destination, source, comparator, lower_bound, middle_bound, threaded - 1}, 
-                    upper_partition = {destination, source, comparator, middle_bound, upper_bound, threaded - 1};
+            if (PolicyT::PARALLEL_PARTITION && threaded > 0 && count > configuration.parallel_partition_minimum_count) {
+                // We could check whether there is any work to do before forking, but we assume
+                // that tasks will only be forked high up in the tree by default, so there *should*
+                // be a significant work available per-task.
+                ParallelPartition<DestinationT, SourceT, ComparatorT, PolicyT> 
+                    lower_partition = {destination, source, comparator, lower_bound, middle_bound, !in_place, threaded - 1, configuration, scheduler, runs}, 
+                    upper_partition = {destination, source, comparator, middle_bound, upper_bound, !in_place, threaded - 1, configuration, scheduler, runs};
                 
-                std::thread 
-                    lower_thread(lower_partition),
-                    upper_thread(upper_partition);
+                Scheduler::FunctorTask<ParallelPartition<DestinationT, SourceT, ComparatorT, PolicyT> > upper_task(upper_partition);
                 
-                upper_thread.join();
-                lower_thread.join();
+                scheduler.fork(upper_task);
+                lower_partition();
+                
+                Trace::Scope join_scope(Trace::JOIN, lower_bound, upper_bound, threaded);
+                scheduler.join(upper_task);
 			} else {
                 // We have hit the bottom of our thread limit.
-                partition(destination, source, comparator, lower_bound, middle_bound);
-                partition(destination, source, comparator, middle_bound, upper_bound);
+                Trace::Scope partition_scope(Trace::PARTITION, lower_bound, upper_bound, threaded);
+                
+                partition<PolicyT>(destination, source, comparator, lower_bound, middle_bound, !in_place, runs);
+                partition<PolicyT>(destination, source, comparator, middle_bound, upper_bound, !in_place, runs);
             }
-            //std::cerr << "Partition Time: " << tp.total() << " [" << lower_bound << " -> " << upper_bound << " : " << threaded << " ]" << std::endl;
             
-            //Benchmark::WallTime tm;
-            if (PARALLEL_MERGE && threaded > 0 && count > PARALLEL_MERGE_MINIMUM_COUNT) {
-                // By the time we get here, we are sure that both left and right partitions have been merged, e.g. we have two ordered sequences [lower_bound, middle_bound] and [middle_bound, upper_bound]. Now, we need to join them together:
-                ParallelLeftMerge<ArrayT, ComparatorT> left_merge = {source, destination, comparator, lower_bound, middle_bound};
-                ParallelRightMerge<ArrayT, ComparatorT> right_merge = {source, destination, comparator, lower_bound, middle_bound, upper_bound};
-                
-                std::thread
-                    left_thread(left_merge),
-                    right_thread(right_merge);
+            Trace::Scope merge_scope(Trace::MERGE, lower_bound, upper_bound, threaded);
+            
+            if (PolicyT::PARALLEL_MERGE && threaded > 0 && count > configuration.parallel_merge_minimum_count) {
+                // By the time we get here, we are sure that both left and right partitions have been merged, e.g. we have two ordered sequences [lower_bound, middle_bound] and [middle_bound, upper_bound]. Now, we need to join them together, using one segment per worker, as long as each segment is reasonably large:
+                std::size_t segments = std::min(scheduler.concurrency(), count / configuration.parallel_merge_minimum_count);
                 
-                left_thread.join();
-                right_thread.join();
+                ParallelMerge<SourceT, DestinationT, ComparatorT, PolicyT> parallel_merge = {source, destination, comparator, lower_bound, middle_bound, upper_bound, 0, count, segments, scheduler};
+                parallel_merge();
             } else {
                 // We have hit the bottom of our thread limit, or the merge minimum count.
-                merge(source, destination, comparator, lower_bound, middle_bound, upper_bound);
+                if (runs)
+                    gallop_merge<PolicyT>(source, destination, comparator, lower_bound, middle_bound, upper_bound);
+                else
+                    merge<PolicyT>(source, destination, comparator, lower_bound, middle_bound, upper_bound);
             }
-            //std::cerr << "Merge Time: " << tm.total() << " [" << lower_bound << " -> " << upper_bound << " : " << threaded << " ]" << std::endl;
         }
     }
     
     /** Parallel Merge Sort, main entry point.
      
-        Given an array of items, a comparator functor, use at most 2^threaded threads to sort the items.   
+        Given a range of items [begin, end] and a comparator functor, split the top configuration.threaded levels of the tree into tasks (at most 2^threaded partitions) and execute them on the given scheduler. Passing the same scheduler to back to back sorts reuses its worker threads.
+        
+        Any random access iterators can be used, e.g. to sort a raw array, a sub-range of a vector, or a std::deque. The caller provides a scratch buffer of at least (end - begin) items, which may be a different type of iterator. Its contents are overwritten, and items are moved rather than copied, so sorting heavy types costs no copies and no allocations.
      
      */
-    template <typename ArrayT, typename ComparatorT>
-    void sort(ArrayT & array, const ComparatorT & comparator, std::size_t threaded = 2) {
-        ArrayT temporary(array.begin(), array.end());
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT, typename ScratchT>
+    void sort(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler, ScratchT scratch) {
+        std::size_t count = end - begin;
         
-        //Benchmark::WallTime ts;
-        if (threaded == 0)
-            partition(temporary, array, comparator, 0, array.size());
+        Trace::Scope sort_scope(Trace::SORT, 0, count, configuration.threaded);
+        
+        if (configuration.threaded == 0)
+            partition<PolicyT>(scratch, begin, comparator, 0, count, true);
         else
-            partition(temporary, array, comparator, 0, array.size(), threaded);
-        //std::cerr << "Total sort time: " << ts.total() << std::endl;
+            partition<PolicyT>(scratch, begin, comparator, 0, count, true, configuration.threaded, configuration, scheduler);
+    }
+    
+    // As above, allocating a scratch buffer of default constructed items.
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT>
+    void sort(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        std::vector<typename std::iterator_traits<IteratorT>::value_type> scratch(end - begin);
+        
+        sort<PolicyT>(begin, end, comparator, configuration, scheduler, scratch.begin());
+    }
+    
+    // Sort a whole container.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void sort(ArrayT & array, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        sort<PolicyT>(array.begin(), array.end(), comparator, configuration, scheduler);
+    }
+    
+    /** Adaptive Parallel Merge Sort.
+     
+        As above, but first scans the range for natural runs (see Runs), so that nearly sorted input sorts in close to linear time. For random input, this costs an extra scan of the range compared to sort.
+     
+     */
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT, typename ScratchT>
+    void sort_adaptive(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler, ScratchT scratch) {
+        std::size_t count = end - begin;
+        Runs runs;
+        
+        Trace::Scope sort_scope(Trace::SORT, 0, count, configuration.threaded);
+        
+        // This reverses descending runs in place.
+        runs.find(begin, count, comparator, configuration.threaded ? scheduler.concurrency() : 1, scheduler);
+        
+        if (runs.sorted(0, count))
+            return;
+        
+        if (configuration.threaded == 0)
+            partition<PolicyT>(scratch, begin, comparator, 0, count, true, &runs);
+        else
+            partition<PolicyT>(scratch, begin, comparator, 0, count, true, configuration.threaded, configuration, scheduler, &runs);
+    }
+    
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT>
+    void sort_adaptive(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        std::vector<typename std::iterator_traits<IteratorT>::value_type> scratch(end - begin);
+        
+        sort_adaptive<PolicyT>(begin, end, comparator, configuration, scheduler, scratch.begin());
+    }
+    
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void sort_adaptive(ArrayT & array, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        sort_adaptive<PolicyT>(array.begin(), array.end(), comparator, configuration, scheduler);
+    }
+    
+    // Sort using the default cutoffs, parallelising the top threaded levels of the tree.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void sort(ArrayT & array, const ComparatorT & comparator, std::size_t threaded, Scheduler & scheduler) {
+        sort<PolicyT>(array, comparator, Configuration(threaded, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT), scheduler);
+    }
+    
+    // As above, using the process wide scheduler.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void sort(ArrayT & array, const ComparatorT & comparator, std::size_t threaded = 2) {
+        sort<PolicyT>(array, comparator, threaded, Scheduler::shared());
+    }
+    
+    // Sort using the configuration which the profile gives for the size of the array. If the profile is empty, the default of threaded = 2 is used.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void sort(ArrayT & array, const ComparatorT & comparator, const Profile & profile, Scheduler & scheduler) {
+        sort<PolicyT>(array, comparator, profile.configuration(array.size(), Configuration(2, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT)), scheduler);
+    }
+    
+    // Counts the number of comparisons made, for measuring the cost of a comparator. Not thread safe.
+    template <typename ComparatorT>
+    struct CountingComparator {
+        const ComparatorT & comparator;
+        std::size_t & count;
+        
+        template <typename ValueT>
+        bool operator()(const ValueT & a, const ValueT & b) const {
+            count += 1;
+            return comparator(a, b);
+        }
+    };
+    
+    struct EmptyTask : public Scheduler::Task {
+        virtual void execute() {}
+    };
+    
+    /** Calibrate a tuning profile for the host.
+     
+        Measures the cost of moving an element by copying the sample, the cost of a comparison by sorting a copy of the sample sequentially while counting comparisons and subtracting the moves it made, and the cost of forking and joining a task on the scheduler. The sample should be representative of the data which will be sorted, e.g. a few hundred thousand real items, and the comparator should be the same one which will be used for sorting. Profile::estimate then chooses a configuration for each input size.
+     
+     */
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    Profile calibrate(const ArrayT & sample, const ComparatorT & comparator, Scheduler & scheduler) {
+        const std::size_t TASK_SAMPLE_COUNT = 1000;
+        
+        std::size_t comparisons = 0;
+        CountingComparator<ComparatorT> counting_comparator = {comparator, comparisons};
+        
+        ArrayT array(sample.begin(), sample.end()), temporary(sample.begin(), sample.end());
+        
+        Benchmark::WallTime sort_time;
+        partition<PolicyT>(temporary.begin(), array.begin(), counting_comparator, 0, array.size(), true);
+        Benchmark::TimeT sort_total = sort_time.total();
+        
+        // Merge sort copies every item once per level, so time a single pass over the sample to estimate the cost of moving an item.
+        Benchmark::WallTime copy_time;
+        std::copy(sample.begin(), sample.end(), temporary.begin());
+        Benchmark::TimeT move_time = sample.size() ? copy_time.total() / sample.size() : 0;
+        
+        // The sort also moved every item once per level, which Profile::estimate adds separately, so only the remainder is attributed to comparisons.
+        std::size_t levels = 0;
+        while ((std::size_t(1) << levels) < sample.size())
+            levels += 1;
+        
+        Benchmark::TimeT comparison_total = std::max<Benchmark::TimeT>(sort_total - move_time * sample.size() * levels, 0);
+        Benchmark::TimeT comparison_time = comparisons ? comparison_total / comparisons : 0;
+        
+        Benchmark::WallTime task_time;
+        for (std::size_t i = 0; i < TASK_SAMPLE_COUNT; i += 1) {
+            EmptyTask task;
+            
+            scheduler.fork(task);
+            scheduler.join(task);
+        }
+        
+        return Profile::estimate(scheduler.concurrency(), sizeof(typename ArrayT::value_type), comparison_time, move_time, task_time.total() / TASK_SAMPLE_COUNT);
     }
 }
 
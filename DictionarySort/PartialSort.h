@@ -0,0 +1,185 @@
+//
+//  PartialSort.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_PartialSort_h
+#define DictionarySort_PartialSort_h
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include "ParallelMergeSort.h"
+
+namespace ParallelMergeSort {
+    /** Parallel Partial Sort.
+
+        Often only the first k items in order are needed, e.g. the first page of results. Sorting everything costs O(n log n), and merging every level of the tree moves every item, even though all but k of them are thrown away.
+
+        A partial sort follows the same tree as partition, but each node only keeps the k smallest items of its range, in order, at the start of the range:
+
+        - A leaf scans its items once, keeping candidates at the start of the range. Each time there are 2k candidates, std::nth_element keeps the k smallest, and the largest of them becomes the threshold which later items must beat. For random input, few items beat the threshold, so the scan is about one comparison per item, and in the worst case (descending input) each item costs a constant number of moves. Then only the k items which are kept are sorted, using the policy's kernels.
+        - A node merges only the first k items of its two children. The co-rank of k (see ParallelMerge) gives how many of them come from each child, so only the items which are kept are moved. Items from the lower child which are not greater than the first item of the upper child are already in place, so if the lower child gives all k items, the merge does nothing at all.
+
+        For n items in 2^threaded leaves, this is O(n + 2^threaded k log k), so taking the first few thousand of a hundred million items is close to linear time, and each merge moves at most k items.
+
+        std::nth_element may reorder items which compare equal. If the policy is STABLE, each leaf is sorted completely instead, so that the result is the same as the first k items of a stable sort.
+
+     */
+    template <typename PolicyT, typename IteratorT, typename ComparatorT>
+    class PartialSort {
+    public:
+        typedef typename std::iterator_traits<IteratorT>::value_type ValueT;
+
+        PartialSort(IteratorT array, std::size_t k, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler)
+            : _array(array), _k(k), _comparator(comparator), _configuration(configuration), _scheduler(scheduler)
+        {
+        }
+
+        // Move the min(k, upper_bound - lower_bound) smallest items of [lower_bound, upper_bound] into order at the start of the range, and return how many there are. The top threaded levels of the tree are executed as tasks.
+        std::size_t sort(std::size_t lower_bound, std::size_t upper_bound, std::size_t threaded);
+
+    protected:
+        IteratorT _array;
+        std::size_t _k;
+        const ComparatorT & _comparator;
+        const Configuration & _configuration;
+        Scheduler & _scheduler;
+
+        struct ParallelPartialSort {
+            PartialSort & partial_sort;
+            std::size_t lower_bound, upper_bound, threaded;
+
+            // The task is copied by the scheduler, so the result is written through a reference.
+            std::size_t & kept;
+
+            void operator()() {
+                kept = partial_sort.sort(lower_bound, upper_bound, threaded);
+            }
+        };
+
+        // Sort a leaf sequentially.
+        std::size_t select(std::size_t lower_bound, std::size_t upper_bound) {
+            std::size_t count = upper_bound - lower_bound;
+            std::size_t kept = std::min(_k, count);
+
+            if (kept == 0)
+                return 0;
+
+            if (kept < count && !PolicyT::STABLE) {
+                IteratorT first = _array + lower_bound;
+
+                // Candidates are swapped to the start of the range. Whenever there are 2k of them, only the k smallest are kept, and the largest of those is the threshold for the next candidate.
+                std::size_t capacity = std::min(count, kept * 2), size = capacity;
+
+                for (std::size_t offset = capacity; offset < count; offset += 1) {
+                    if (size == capacity) {
+                        std::nth_element(first, first + (kept - 1), first + size, _comparator);
+                        size = kept;
+                    }
+
+                    // The threshold doesn't move until the next time the candidates are selected.
+                    if (_comparator(first[offset], first[kept - 1])) {
+                        std::iter_swap(first + size, first + offset);
+                        size += 1;
+                    }
+                }
+
+                if (size > kept)
+                    std::nth_element(first, first + (kept - 1), first + size, _comparator);
+
+                count = kept;
+            }
+
+            std::vector<ValueT> scratch(count);
+            partition<PolicyT>(scratch.begin(), _array + lower_bound, _comparator, 0, count, true);
+
+            return kept;
+        }
+
+        // Merge the first items of [lower_bound, lower_bound + lower_count] and [middle_bound, middle_bound + upper_count] into the start of [lower_bound, ...], and return how many were kept.
+        std::size_t merge(std::size_t lower_bound, std::size_t lower_count, std::size_t middle_bound, std::size_t upper_count) {
+            std::size_t kept = std::min(_k, lower_count + upper_count);
+
+            // The number of items which are taken from the lower child.
+            std::size_t low = kept > upper_count ? kept - upper_count : 0;
+            std::size_t split = co_rank(_array, _comparator, lower_bound, middle_bound, kept, low, std::min(kept, lower_count));
+
+            if (split == kept)
+                return kept;
+
+            // Items from the lower child which come before every item from the upper child are already in place.
+            std::size_t offset = std::upper_bound(_array + lower_bound, _array + lower_bound + split, _array[middle_bound], _comparator) - _array;
+
+            std::vector<ValueT> merged(lower_bound + kept - offset);
+            PolicyT::template MergeKernelT<ComparatorT, ValueT>::merge(_array, merged.begin(), _comparator, offset, lower_bound + split, middle_bound, middle_bound + (kept - split), 0);
+
+            // The items of the lower child which are not kept move into the places of the items which were taken from the upper child, so that the range is still a permutation of its items.
+            std::size_t end_bound = lower_bound + kept;
+            std::move(_array + lower_bound + split, _array + std::min(middle_bound, end_bound), _array + std::max(middle_bound, end_bound));
+
+            std::move(merged.begin(), merged.end(), _array + offset);
+
+            return kept;
+        }
+    };
+
+    template <typename PolicyT, typename IteratorT, typename ComparatorT>
+    std::size_t PartialSort<PolicyT, IteratorT, ComparatorT>::sort(std::size_t lower_bound, std::size_t upper_bound, std::size_t threaded) {
+        std::size_t count = upper_bound - lower_bound;
+
+        if (threaded == 0 || count <= 1 || count <= _configuration.parallel_partition_minimum_count) {
+            Trace::Scope partition_scope(Trace::PARTITION, lower_bound, upper_bound, threaded);
+
+            return select(lower_bound, upper_bound);
+        }
+
+        Trace::Scope node_scope(Trace::NODE, lower_bound, upper_bound, threaded);
+
+        std::size_t middle_bound = (lower_bound + upper_bound) / 2;
+        std::size_t lower_count, upper_count;
+
+        if (PolicyT::PARALLEL_PARTITION) {
+            ParallelPartialSort upper_partial_sort = {*this, middle_bound, upper_bound, threaded - 1, upper_count};
+            Scheduler::FunctorTask<ParallelPartialSort> upper_task(upper_partial_sort);
+
+            _scheduler.fork(upper_task);
+            lower_count = sort(lower_bound, middle_bound, threaded - 1);
+
+            Trace::Scope join_scope(Trace::JOIN, lower_bound, upper_bound, threaded);
+            _scheduler.join(upper_task);
+        } else {
+            lower_count = sort(lower_bound, middle_bound, threaded - 1);
+            upper_count = sort(middle_bound, upper_bound, threaded - 1);
+        }
+
+        Trace::Scope merge_scope(Trace::MERGE, lower_bound, upper_bound, threaded);
+
+        return merge(lower_bound, lower_count, middle_bound, upper_count);
+    }
+
+    // Move the k smallest items of [begin, end] into order at [begin, begin + k], see PartialSort. The order of the remaining items is unspecified. If k is at least the number of items, this is the same as sort.
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT>
+    void partial_sort(IteratorT begin, IteratorT end, std::size_t k, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        std::size_t count = end - begin;
+
+        if (k >= count) {
+            sort<PolicyT>(begin, end, comparator, configuration, scheduler);
+            return;
+        }
+
+        Trace::Scope sort_scope(Trace::SORT, 0, count, configuration.threaded);
+
+        PartialSort<PolicyT, IteratorT, ComparatorT> partial_sort(begin, k, comparator, configuration, scheduler);
+        partial_sort.sort(0, count, configuration.threaded);
+    }
+
+    // Partially sort a whole container, parallelising the top threaded levels of the tree using the process wide scheduler.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+    void partial_sort(ArrayT & array, std::size_t k, const ComparatorT & comparator, std::size_t threaded = 2) {
+        partial_sort<PolicyT>(array.begin(), array.end(), k, comparator, Configuration(threaded, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT), Scheduler::shared());
+    }
+}
+
+#endif
@@ -0,0 +1,251 @@
+//
+//  RadixSort.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_RadixSort_h
+#define DictionarySort_RadixSort_h
+
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <vector>
+
+#include "ParallelMergeSort.h"
+
+namespace ParallelMergeSort {
+    /** Parallel MSD Radix Sort.
+
+        When every item can be described by a sequence of 64-bit segments which compare lexicographically (e.g. the order vector given by Dictionary::sum), we can sort by distributing items into buckets one byte at a time, starting with the most significant byte of the first segment. Only buckets which contain more than one item need to look at the next byte, and only buckets which tie on a whole segment look at the next segment, so most items are never compared at all.
+
+        A key functor describes the segments of an item:
+
+            struct KeyT {
+                // The number of segments of the item. A shorter sequence of segments sorts before a longer one with the same prefix.
+                std::size_t size(const ValueT & item) const;
+
+                // The given segment of the item.
+                std::uint64_t operator()(const ValueT & item, std::size_t segment) const;
+            };
+
+        Each pass has RADIX_BUCKET_COUNT buckets: bucket 0 holds the items which have no more segments, and these are equal, so they are finished. The remaining buckets hold the items with each value of the current byte.
+
+        Each pass counts the items in each bucket, moves the items into the scratch buffer in bucket order, and then moves them back, so the sort is stable. Large passes are split into chunks which are counted and moved in parallel, and large buckets are sorted as tasks. Buckets with RADIX_MINIMUM_COUNT items or fewer are sorted using the comparator instead, which must agree with the order given by the key.
+
+     */
+
+    // One bucket for items with no more segments, and one for each value of a byte.
+    const std::size_t RADIX_BUCKET_COUNT = 257;
+
+    // Smaller buckets are sorted using the comparison sort.
+    const std::size_t RADIX_MINIMUM_COUNT = 64;
+
+    // Larger passes are split into chunks, and larger buckets are sorted as tasks.
+    const std::size_t PARALLEL_RADIX_MINIMUM_COUNT = 1024 * 16;
+
+    template <typename IteratorT, typename ScratchT, typename KeyT, typename ComparatorT>
+    class RadixSort {
+    public:
+        RadixSort(IteratorT array, ScratchT scratch, const KeyT & key, const ComparatorT & comparator, Scheduler & scheduler)
+            : _array(array), _scratch(scratch), _key(key), _comparator(comparator), _scheduler(scheduler)
+        {
+        }
+
+        // Sort [lower_bound, upper_bound], where every item has the same segments before the given byte of the given segment.
+        void sort(std::size_t lower_bound, std::size_t upper_bound, std::size_t segment, std::size_t byte);
+
+    protected:
+        IteratorT _array;
+        ScratchT _scratch;
+        const KeyT & _key;
+        const ComparatorT & _comparator;
+        Scheduler & _scheduler;
+
+        enum Phase {
+            COUNT, DISTRIBUTE, RESTORE
+        };
+
+        // A part of a pass, which counts or moves the items in [lower_bound, upper_bound].
+        struct Chunk {
+            RadixSort & radix;
+            std::size_t lower_bound, upper_bound, segment, byte;
+
+            // The number of items in each bucket, and then the offset in the scratch buffer where the next item of each bucket goes.
+            std::size_t counts[RADIX_BUCKET_COUNT];
+
+            Chunk(RadixSort & _radix, std::size_t _lower_bound, std::size_t _upper_bound, std::size_t _segment, std::size_t _byte)
+                : radix(_radix), lower_bound(_lower_bound), upper_bound(_upper_bound), segment(_segment), byte(_byte), counts()
+            {
+            }
+        };
+
+        struct ParallelChunk {
+            Chunk & chunk;
+            Phase phase;
+
+            void operator()() {
+                chunk.radix.execute(chunk, phase);
+            }
+        };
+
+        struct ParallelBucket {
+            RadixSort & radix;
+            std::size_t lower_bound, upper_bound, segment, byte;
+
+            void operator()() {
+                radix.sort(lower_bound, upper_bound, segment, byte);
+            }
+        };
+
+        std::size_t digit(std::size_t index, std::size_t segment, std::size_t byte) const {
+            const typename std::iterator_traits<IteratorT>::value_type & item = _array[index];
+
+            if (segment >= _key.size(item))
+                return 0;
+
+            return 1 + ((_key(item, segment) >> (56 - byte * 8)) & 0xFF);
+        }
+
+        // Every item in [lower_bound, upper_bound] has the given segment, and the same value for the given byte. Continue sorting from the first byte where they differ.
+        void skip(std::size_t lower_bound, std::size_t upper_bound, std::size_t segment, std::size_t byte) {
+            std::uint64_t first = _key(_array[lower_bound], segment), difference = 0;
+
+            for (std::size_t i = lower_bound + 1; i < upper_bound; i += 1)
+                difference |= _key(_array[i], segment) ^ first;
+
+            if (difference == 0) {
+                sort(lower_bound, upper_bound, segment + 1, 0);
+            } else {
+                while (((difference >> (56 - byte * 8)) & 0xFF) == 0)
+                    byte += 1;
+
+                sort(lower_bound, upper_bound, segment, byte);
+            }
+        }
+
+        void execute(Chunk & chunk, Phase phase) {
+            if (phase == COUNT) {
+                std::fill(chunk.counts, chunk.counts + RADIX_BUCKET_COUNT, 0);
+
+                for (std::size_t i = chunk.lower_bound; i < chunk.upper_bound; i += 1)
+                    chunk.counts[digit(i, chunk.segment, chunk.byte)] += 1;
+            } else if (phase == DISTRIBUTE) {
+                for (std::size_t i = chunk.lower_bound; i < chunk.upper_bound; i += 1)
+                    _scratch[chunk.counts[digit(i, chunk.segment, chunk.byte)]++] = std::move(_array[i]);
+            } else {
+                std::move(_scratch + chunk.lower_bound, _scratch + chunk.upper_bound, _array + chunk.lower_bound);
+            }
+        }
+
+        // Execute the given phase of every chunk, the first one on the calling thread.
+        void execute(std::deque<Chunk> & chunks, Phase phase) {
+            std::deque<Scheduler::FunctorTask<ParallelChunk> > tasks;
+
+            for (std::size_t i = 0; i < chunks.size(); i += 1) {
+                ParallelChunk parallel_chunk = {chunks[i], phase};
+                tasks.emplace_back(parallel_chunk);
+            }
+
+            _scheduler.fork_join(tasks);
+        }
+    };
+
+    template <typename IteratorT, typename ScratchT, typename KeyT, typename ComparatorT>
+    void RadixSort<IteratorT, ScratchT, KeyT, ComparatorT>::sort(std::size_t lower_bound, std::size_t upper_bound, std::size_t segment, std::size_t byte) {
+        std::size_t count = upper_bound - lower_bound;
+
+        if (count <= RADIX_MINIMUM_COUNT) {
+            partition(_scratch, _array, _comparator, lower_bound, upper_bound, true);
+            return;
+        }
+
+        std::size_t chunk_count = 1;
+        if (count >= PARALLEL_RADIX_MINIMUM_COUNT * 2)
+            chunk_count = std::max<std::size_t>(1, std::min(_scheduler.concurrency(), count / PARALLEL_RADIX_MINIMUM_COUNT));
+
+        // The chunks are referred to by tasks, so they must not move.
+        std::deque<Chunk> chunks;
+
+        for (std::size_t i = 0; i < chunk_count; i += 1) {
+            chunks.push_back(Chunk(*this, lower_bound + count * i / chunk_count, lower_bound + count * (i+1) / chunk_count, segment, byte));
+        }
+
+        execute(chunks, COUNT);
+
+        // Each chunk moves its items of each bucket after the items of the same bucket from the previous chunks, which keeps the sort stable.
+        std::size_t bounds[RADIX_BUCKET_COUNT + 1];
+        std::size_t offset = lower_bound, largest_count = 0;
+
+        for (std::size_t b = 0; b < RADIX_BUCKET_COUNT; b += 1) {
+            bounds[b] = offset;
+
+            for (std::size_t i = 0; i < chunk_count; i += 1) {
+                std::size_t bucket_count = chunks[i].counts[b];
+                chunks[i].counts[b] = offset;
+                offset += bucket_count;
+            }
+
+            largest_count = std::max(largest_count, offset - bounds[b]);
+        }
+
+        bounds[RADIX_BUCKET_COUNT] = upper_bound;
+
+        // If every item is in the same bucket, e.g. the most significant byte is unused, or the items are equal, there is nothing to move, and we can skip to the first byte where the items differ.
+        if (largest_count == count) {
+            if (bounds[1] == upper_bound)
+                return;
+
+            skip(lower_bound, upper_bound, segment, byte);
+            return;
+        }
+
+        execute(chunks, DISTRIBUTE);
+        execute(chunks, RESTORE);
+
+        std::size_t next_segment = segment, next_byte = byte + 1;
+
+        if (next_byte == sizeof(std::uint64_t)) {
+            next_segment += 1;
+            next_byte = 0;
+        }
+
+        std::deque<Scheduler::FunctorTask<ParallelBucket> > tasks;
+
+        // Items in bucket 0 have no more segments, so they are equal and already sorted.
+        for (std::size_t b = 1; b < RADIX_BUCKET_COUNT; b += 1) {
+            std::size_t bucket_count = bounds[b+1] - bounds[b];
+
+            if (bucket_count > 1) {
+                ParallelBucket bucket = {*this, bounds[b], bounds[b+1], next_segment, next_byte};
+
+                if (bucket_count >= PARALLEL_RADIX_MINIMUM_COUNT) {
+                    tasks.emplace_back(bucket);
+                    _scheduler.fork(tasks.back());
+                } else {
+                    bucket();
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < tasks.size(); i += 1)
+            _scheduler.join(tasks[i]);
+    }
+
+    // Sort [begin, end] using the given key, see RadixSort. The scratch buffer must have at least (end - begin) items.
+    template <typename IteratorT, typename KeyT, typename ComparatorT, typename ScratchT>
+    void radix_sort(IteratorT begin, IteratorT end, const KeyT & key, const ComparatorT & comparator, Scheduler & scheduler, ScratchT scratch) {
+        RadixSort<IteratorT, ScratchT, KeyT, ComparatorT> radix(begin, scratch, key, comparator, scheduler);
+
+        radix.sort(0, end - begin, 0, 0);
+    }
+
+    // As above, allocating a scratch buffer of default constructed items.
+    template <typename IteratorT, typename KeyT, typename ComparatorT>
+    void radix_sort(IteratorT begin, IteratorT end, const KeyT & key, const ComparatorT & comparator, Scheduler & scheduler) {
+        std::vector<typename std::iterator_traits<IteratorT>::value_type> scratch(end - begin);
+
+        radix_sort(begin, end, key, comparator, scheduler, scratch.begin());
+    }
+}
+
+#endif
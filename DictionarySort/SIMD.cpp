@@ -0,0 +1,261 @@
+//
+//  SIMD.cpp
+//  DictionarySort
+//
+
+#include "SIMD.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DICTIONARY_SORT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace DictionarySort {
+    namespace SIMD {
+        static void sum_scalar(const Translation & translation, const std::uint8_t * characters, std::size_t count, unsigned width, unsigned characters_per_segment, SegmentT * order)
+        {
+            const std::uint8_t * end = characters + count;
+
+            while (characters != end) {
+                unsigned remaining = characters_per_segment;
+                SegmentT sum = 0;
+
+                while (characters != end) {
+                    remaining -= 1;
+
+                    sum <<= width;
+                    sum += translation.orders[*characters++];
+
+                    if (remaining == 0)
+                        break;
+                }
+
+                // The first character is the most significant, so a partial segment is padded on the right.
+                sum <<= (remaining * width);
+                *order++ = sum;
+            }
+        }
+
+        static std::size_t mismatch_segments_scalar(const SegmentT * lhs, const SegmentT * rhs, std::size_t count)
+        {
+            return mismatch<SegmentT>(lhs, rhs, count);
+        }
+
+        static std::size_t mismatch_characters_scalar(const std::uint8_t * lhs, const std::uint8_t * rhs, std::size_t count)
+        {
+            return mismatch<std::uint8_t>(lhs, rhs, count);
+        }
+
+#ifdef DICTIONARY_SORT_X86
+        static const std::uintptr_t PAGE_SIZE = 4096;
+
+        static const std::size_t SUM_MINIMUM_CHARACTERS = 64;
+
+        // Translate 32 characters: each group of 16 characters which contains a letter is looked up by the low nibble of every character, and kept for the characters whose high nibble selects that group.
+        __attribute__((target("avx2")))
+        static inline __m256i translate_avx2(const Translation & translation, __m256i characters)
+        {
+            const __m256i nibble = _mm256_set1_epi8(0x0F);
+            __m256i low = _mm256_and_si256(characters, nibble);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(characters, 4), nibble);
+            __m256i orders = _mm256_setzero_si256();
+
+            for (unsigned groups = translation.groups; groups; groups &= groups - 1) {
+                int group = __builtin_ctz(groups);
+
+                __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(translation.orders + group * 16)));
+                __m256i selected = _mm256_cmpeq_epi8(high, _mm256_set1_epi8(group));
+
+                orders = _mm256_or_si256(orders, _mm256_and_si256(_mm256_shuffle_epi8(table, low), selected));
+            }
+
+            return orders;
+        }
+
+        // Load the next 32 characters, of which only the first count are valid.
+        __attribute__((target("avx2"), no_sanitize_address))
+        static inline __m256i load_avx2(const std::uint8_t * characters, std::size_t count)
+        {
+            // Reading past the end is safe as long as it doesn't cross into the next page, which may not be mapped.
+            if (count >= 32 || ((std::uintptr_t)characters & (PAGE_SIZE - 1)) <= PAGE_SIZE - 32)
+                return _mm256_loadu_si256((const __m256i *)characters);
+
+            std::uint8_t buffer[32];
+            std::memcpy(buffer, characters, count);
+
+            return _mm256_loadu_si256((const __m256i *)buffer);
+        }
+
+        // Pack the orders of 64 characters into width 64-bit words, the first character most significant. Every 8 characters are packed into 8 * width bits using a parallel bit extract, and since 64 characters fill exactly width words, the words can be built with constant shifts.
+        template <unsigned WIDTH>
+        __attribute__((target("avx2,bmi2"), always_inline))
+        static inline void pack_avx2(__m256i first, __m256i second, std::uint64_t * words)
+        {
+            const std::uint64_t mask = 0x0101010101010101ULL * ((1u << WIDTH) - 1);
+
+            std::uint64_t groups[8] = {
+                std::uint64_t(_mm256_extract_epi64(first, 0)),
+                std::uint64_t(_mm256_extract_epi64(first, 1)),
+                std::uint64_t(_mm256_extract_epi64(first, 2)),
+                std::uint64_t(_mm256_extract_epi64(first, 3)),
+                std::uint64_t(_mm256_extract_epi64(second, 0)),
+                std::uint64_t(_mm256_extract_epi64(second, 1)),
+                std::uint64_t(_mm256_extract_epi64(second, 2)),
+                std::uint64_t(_mm256_extract_epi64(second, 3))
+            };
+
+            std::uint64_t packed[WIDTH + 1] = {};
+
+#pragma GCC unroll 8
+            for (unsigned group = 0; group < 8; group += 1) {
+                const unsigned offset = 8 * WIDTH * group, index = offset / 64, shift = offset % 64;
+
+                // The first character moves to the most significant byte, and then the width bits of every character are packed together at the top of the word.
+                std::uint64_t bits = _pext_u64(__builtin_bswap64(groups[group]), mask) << (64 - 8 * WIDTH);
+
+                packed[index] |= bits >> shift;
+
+                if (shift + 8 * WIDTH > 64)
+                    packed[index + 1] |= bits << (64 - shift);
+            }
+
+            for (unsigned index = 0; index < WIDTH; index += 1)
+                words[index] = packed[index];
+        }
+
+        // Characters are processed in chunks of 64 segments, which pack into exactly characters_per_segment * WIDTH words. Each segment is then taken from the packed words independently of the others. The orders after the last character are cleared, which pads the last segment.
+        template <unsigned WIDTH>
+        __attribute__((target("avx2,bmi2")))
+        static void sum_avx2(const Translation & translation, const std::uint8_t * characters, std::size_t count, unsigned characters_per_segment, SegmentT * order)
+        {
+            const __m256i index = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+
+            const unsigned segment_width = WIDTH * characters_per_segment;
+            const std::size_t chunk = 64 * characters_per_segment;
+
+            // The last word is only read, by a segment which ends at the end of the word before it.
+            std::uint64_t words[64 + 1];
+
+            for (std::size_t offset = 0; offset < count; offset += chunk) {
+                const std::size_t length = std::min(chunk, count - offset);
+                std::uint64_t * packed = words;
+
+                for (std::size_t block = 0; block < length; block += 64) {
+                    const std::uint8_t * current = characters + offset + block;
+                    std::size_t remaining = length - block;
+
+                    __m256i first = translate_avx2(translation, load_avx2(current, remaining)), second = _mm256_setzero_si256();
+
+                    if (remaining < 32) {
+                        first = _mm256_and_si256(first, _mm256_cmpgt_epi8(_mm256_set1_epi8(char(remaining)), index));
+                    } else if (remaining > 32) {
+                        second = translate_avx2(translation, load_avx2(current + 32, remaining - 32));
+
+                        if (remaining < 64)
+                            second = _mm256_and_si256(second, _mm256_cmpgt_epi8(_mm256_set1_epi8(char(remaining - 32)), index));
+                    }
+
+                    pack_avx2<WIDTH>(first, second, packed);
+                    packed += WIDTH;
+                }
+
+                *packed = 0;
+
+                const std::size_t segments = (length + characters_per_segment - 1) / characters_per_segment;
+
+                for (std::size_t segment = 0; segment < segments; segment += 1) {
+                    const std::size_t bit = segment * segment_width;
+                    const unsigned shift = bit % 64;
+                    const std::uint64_t * word = words + bit / 64;
+
+                    // The segment may straddle two words; shifting the second word in two steps handles a shift of 0 without a branch.
+                    std::uint64_t value = (word[0] << shift) | ((word[1] >> 1) >> (63 - shift));
+
+                    *order++ = value >> (64 - segment_width);
+                }
+            }
+        }
+
+        static void sum_avx2(const Translation & translation, const std::uint8_t * characters, std::size_t count, unsigned width, unsigned characters_per_segment, SegmentT * order)
+        {
+            // Short words are most of the words in a typical dictionary, and are faster to translate one character at a time.
+            if (count < SUM_MINIMUM_CHARACTERS)
+                return sum_scalar(translation, characters, count, width, characters_per_segment, order);
+
+            switch (width) {
+                case 1: return sum_avx2<1>(translation, characters, count, characters_per_segment, order);
+                case 2: return sum_avx2<2>(translation, characters, count, characters_per_segment, order);
+                case 3: return sum_avx2<3>(translation, characters, count, characters_per_segment, order);
+                case 4: return sum_avx2<4>(translation, characters, count, characters_per_segment, order);
+                case 5: return sum_avx2<5>(translation, characters, count, characters_per_segment, order);
+                case 6: return sum_avx2<6>(translation, characters, count, characters_per_segment, order);
+                case 7: return sum_avx2<7>(translation, characters, count, characters_per_segment, order);
+                default: return sum_avx2<8>(translation, characters, count, characters_per_segment, order);
+            }
+        }
+
+        __attribute__((target("avx2")))
+        static std::size_t mismatch_segments_avx2(const SegmentT * lhs, const SegmentT * rhs, std::size_t count)
+        {
+            std::size_t offset = 0;
+
+            for (; offset + 4 <= count; offset += 4) {
+                __m256i equal = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)(lhs + offset)), _mm256_loadu_si256((const __m256i *)(rhs + offset)));
+                unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+
+                if (mask != 0xF)
+                    return offset + __builtin_ctz(~mask);
+            }
+
+            return offset + mismatch<SegmentT>(lhs + offset, rhs + offset, count - offset);
+        }
+
+        __attribute__((target("avx2")))
+        static std::size_t mismatch_characters_avx2(const std::uint8_t * lhs, const std::uint8_t * rhs, std::size_t count)
+        {
+            std::size_t offset = 0;
+
+            for (; offset + 32 <= count; offset += 32) {
+                __m256i equal = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(lhs + offset)), _mm256_loadu_si256((const __m256i *)(rhs + offset)));
+                unsigned mask = _mm256_movemask_epi8(equal);
+
+                if (mask != 0xFFFFFFFF)
+                    return offset + __builtin_ctz(~mask);
+            }
+
+            return offset + mismatch<std::uint8_t>(lhs + offset, rhs + offset, count - offset);
+        }
+
+        static const Kernels AVX2_KERNELS = {"avx2", sum_avx2, mismatch_segments_avx2, mismatch_characters_avx2};
+#endif
+
+        static const Kernels SCALAR_KERNELS = {"scalar", sum_scalar, mismatch_segments_scalar, mismatch_characters_scalar};
+
+        static const Kernels & select()
+        {
+#ifdef DICTIONARY_SORT_X86
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+                return AVX2_KERNELS;
+#endif
+
+            return SCALAR_KERNELS;
+        }
+
+        const Kernels & kernels()
+        {
+            static const Kernels & selected = select();
+
+            return selected;
+        }
+
+        const Kernels & scalar_kernels()
+        {
+            return SCALAR_KERNELS;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+//
+//  SIMD.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_SIMD_h
+#define DictionarySort_SIMD_h
+
+#include <cstddef>
+#include <cstdint>
+
+namespace DictionarySort {
+    /** Vector Kernels.
+
+        Generating the order of every word, and comparing orders and words, is most of the work of a dictionary sort besides moving records. These kernels do that work for dictionaries of single byte characters with fewer than 256 letters, where the order of every character fits in a byte:
+
+        - sum translates 32 characters at a time using byte shuffles, one for each group of 16 characters which contains a letter, and packs the orders of 8 characters at a time using a parallel bit extract. This only pays for itself on long words, so shorter words are translated one character at a time.
+        - mismatch finds the first difference between two sequences of segments or characters, 4 segments or 32 characters at a time.
+
+        The fastest kernels which the processor supports are chosen the first time they are used. The scalar kernels are used on every other processor, and can be used to check the others.
+
+     */
+    namespace SIMD {
+        typedef std::uint64_t SegmentT;
+
+        // The order of each single byte character.
+        struct Translation {
+            std::uint8_t orders[256];
+
+            // Bit n is set if any character in [16n, 16n + 16) has a non-zero order. Every other character translates to 0, so the vector kernels skip those groups.
+            std::uint16_t groups;
+
+            void clear() {
+                for (std::size_t i = 0; i < 256; i += 1)
+                    orders[i] = 0;
+
+                groups = 0;
+            }
+
+            void assign(std::uint8_t character, std::uint8_t order) {
+                orders[character] = order;
+
+                if (order)
+                    groups |= 1 << (character >> 4);
+            }
+        };
+
+        struct Kernels {
+            const char * name;
+
+            // Write the order of count characters as in Dictionary::sum, i.e. ceil(count / characters_per_segment) segments of width bits per character, the first character most significant. The width must be at most 8.
+            void (*sum)(const Translation & translation, const std::uint8_t * characters, std::size_t count, unsigned width, unsigned characters_per_segment, SegmentT * order);
+
+            // The index of the first difference between lhs and rhs, or count if they are equal.
+            std::size_t (*mismatch_segments)(const SegmentT * lhs, const SegmentT * rhs, std::size_t count);
+            std::size_t (*mismatch_characters)(const std::uint8_t * lhs, const std::uint8_t * rhs, std::size_t count);
+        };
+
+        // The fastest kernels which this processor supports.
+        const Kernels & kernels();
+
+        const Kernels & scalar_kernels();
+
+        // Shorter sequences are compared inline, since most comparisons are decided by the first few elements, and the call would cost more than the loop.
+        const std::size_t MISMATCH_MINIMUM_COUNT = 4;
+        const std::size_t MISMATCH_MINIMUM_CHARACTERS = 32;
+
+        template <typename ValueT>
+        inline std::size_t mismatch(const ValueT * lhs, const ValueT * rhs, std::size_t count) {
+            std::size_t offset = 0;
+
+            while (offset < count && lhs[offset] == rhs[offset])
+                offset += 1;
+
+            return offset;
+        }
+
+        inline std::size_t mismatch(const SegmentT * lhs, const SegmentT * rhs, std::size_t count) {
+            if (count < MISMATCH_MINIMUM_COUNT)
+                return mismatch<SegmentT>(lhs, rhs, count);
+
+            return kernels().mismatch_segments(lhs, rhs, count);
+        }
+
+        inline std::size_t mismatch(const char * lhs, const char * rhs, std::size_t count) {
+            if (count < MISMATCH_MINIMUM_CHARACTERS)
+                return mismatch<char>(lhs, rhs, count);
+
+            return kernels().mismatch_characters((const std::uint8_t *)lhs, (const std::uint8_t *)rhs, count);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,383 @@
+//
+//  Scheduler.cpp
+//  DictionarySort
+//
+
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#if PARALLEL_MERGE_SORT_LIBNUMA
+#include <numa.h>
+#endif
+
+namespace ParallelMergeSort {
+    // How many times an idle worker looks for work before going to sleep.
+    static const std::size_t IDLE_SPIN_COUNT = 64;
+    
+    thread_local Scheduler::Worker * Scheduler::_current = 0;
+    
+    // Per-thread state for choosing a victim to steal from, so that thieves don't all hammer the same deque.
+    static thread_local std::size_t steal_seed = 0;
+    
+#if defined(__linux__) && !PARALLEL_MERGE_SORT_LIBNUMA
+    // Parse a list of CPUs or nodes as given by sysfs, e.g. "0-3,8-11".
+    static std::vector<int> parse_list(const std::string & text)
+    {
+        std::vector<int> list;
+        std::istringstream stream(text);
+        std::string range;
+        
+        while (std::getline(stream, range, ',')) {
+            int first = 0, last = 0;
+            char separator = 0;
+            std::istringstream range_stream(range);
+            
+            if (!(range_stream >> first))
+                continue;
+            
+            if (range_stream >> separator >> last && separator == '-') {
+                for (int i = first; i <= last; i += 1)
+                    list.push_back(i);
+            } else {
+                list.push_back(first);
+            }
+        }
+        
+        return list;
+    }
+    
+    static std::string read_line(const std::string & path)
+    {
+        std::ifstream file(path.c_str());
+        std::string line;
+        
+        std::getline(file, line);
+        
+        return line;
+    }
+#endif
+    
+    // The CPUs which the process may run on, along with their NUMA node, ordered by node.
+    static std::vector<std::pair<std::size_t, int> > topology()
+    {
+        std::vector<std::pair<std::size_t, int> > cpus;
+        
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return cpus;
+        
+        // Any CPU which isn't listed by a node is on node 0.
+        std::vector<std::size_t> nodes(CPU_SETSIZE, 0);
+        
+#if PARALLEL_MERGE_SORT_LIBNUMA
+        if (numa_available() >= 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu += 1) {
+                if (CPU_ISSET(cpu, &allowed))
+                    nodes[cpu] = std::max(numa_node_of_cpu(cpu), 0);
+            }
+        }
+#else
+        std::vector<int> online = parse_list(read_line("/sys/devices/system/node/online"));
+        
+        for (std::size_t i = 0; i < online.size(); i += 1) {
+            std::ostringstream path;
+            path << "/sys/devices/system/node/node" << online[i] << "/cpulist";
+            
+            std::vector<int> node_cpus = parse_list(read_line(path.str()));
+            
+            for (std::size_t j = 0; j < node_cpus.size(); j += 1) {
+                if (node_cpus[j] >= 0 && node_cpus[j] < CPU_SETSIZE)
+                    nodes[node_cpus[j]] = online[i];
+            }
+        }
+#endif
+        
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu += 1) {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(std::make_pair(nodes[cpu], cpu));
+        }
+        
+        std::sort(cpus.begin(), cpus.end());
+#endif
+        
+        return cpus;
+    }
+    
+    Scheduler::Scheduler(std::size_t workers, bool pinned)
+        : _pinned(pinned), _nodes(1), _queued(0), _stopping(false), _sleeping(0), _joining(0)
+    {
+        if (workers == 0)
+            workers = std::thread::hardware_concurrency();
+        
+        // hardware_concurrency() may return 0 if it can't be determined.
+        if (workers == 0)
+            workers = 1;
+        
+        _submissions.scheduler = this;
+        _submissions.pinned_count = 0;
+        _submissions.cpu = -1;
+        _submissions.node = 0;
+        
+        std::vector<std::pair<std::size_t, int> > cpus;
+        std::set<std::size_t> nodes;
+        
+        if (pinned)
+            cpus = topology();
+        
+        // All workers must exist before any of them start stealing. If there are more workers than CPUs, the CPUs are shared in the same order, so each range of workers is still spread over the nodes evenly.
+        for (std::size_t i = 0; i < workers; i += 1) {
+            Worker * worker = new Worker;
+            worker->scheduler = this;
+            worker->pinned_count = 0;
+            worker->cpu = -1;
+            worker->node = 0;
+            
+            if (!cpus.empty()) {
+                const std::pair<std::size_t, int> & cpu = cpus[i * cpus.size() / workers];
+                
+                worker->node = cpu.first;
+                worker->cpu = cpu.second;
+            }
+            
+            nodes.insert(worker->node);
+            _workers.push_back(worker);
+        }
+        
+        _nodes = nodes.size();
+        
+        for (std::size_t i = 0; i < workers; i += 1) {
+            _workers[i]->thread = std::thread(&Scheduler::run, this, _workers[i]);
+        }
+    }
+    
+    Scheduler::~Scheduler()
+    {
+        _stopping = true;
+        
+        {
+            std::lock_guard<std::mutex> lock(_idle_lock);
+            _available.notify_all();
+        }
+        
+        for (std::size_t i = 0; i < _workers.size(); i += 1) {
+            _workers[i]->thread.join();
+            delete _workers[i];
+        }
+    }
+    
+    Scheduler & Scheduler::shared()
+    {
+        static Scheduler scheduler;
+        
+        return scheduler;
+    }
+    
+    Scheduler::Worker * Scheduler::current() const
+    {
+        if (_current && _current->scheduler == this)
+            return _current;
+        
+        return 0;
+    }
+    
+    void Scheduler::fork(Task & task)
+    {
+        Worker * worker = current();
+        
+        if (!worker)
+            worker = &_submissions;
+        
+        {
+            std::lock_guard<std::mutex> lock(worker->lock);
+            worker->tasks.push_back(&task);
+        }
+        
+        _queued += 1;
+        
+        // Both counters are sequentially consistent with respect to _queued, so a thread which is about to sleep will either see the new task or be woken up here.
+        if (_sleeping > 0 || _joining > 0) {
+            std::lock_guard<std::mutex> lock(_idle_lock);
+            
+            _available.notify_one();
+            
+            // Threads waiting in join() can help with the new task too.
+            _completed.notify_all();
+        }
+    }
+    
+    void Scheduler::fork(Task & task, std::size_t index)
+    {
+        Worker * worker = _workers[index];
+        
+        {
+            std::lock_guard<std::mutex> lock(worker->lock);
+            worker->pinned.push_back(&task);
+        }
+        
+        worker->pinned_count += 1;
+        
+        // Only the given worker can execute the task, and we don't know which of the sleeping or joining threads it is.
+        if (_sleeping > 0 || _joining > 0) {
+            std::lock_guard<std::mutex> lock(_idle_lock);
+            
+            _available.notify_all();
+            _completed.notify_all();
+        }
+    }
+    
+    void Scheduler::join(Task & task)
+    {
+        Worker * worker = current();
+        
+        while (!task.complete()) {
+            if (Task * next = find(worker)) {
+                execute(next);
+            } else {
+                // The task is running on another thread, and there is nothing we can help with.
+                std::unique_lock<std::mutex> lock(_idle_lock);
+                _joining += 1;
+                
+                // The timeout is a safety net, we expect to be notified when any task completes or is forked.
+                if (!task.complete() && _queued == 0 && !(worker && worker->pinned_count > 0))
+                    _completed.wait_for(lock, std::chrono::milliseconds(1));
+                
+                _joining -= 1;
+            }
+        }
+    }
+    
+    Scheduler::Task * Scheduler::pop(Worker * worker)
+    {
+        std::lock_guard<std::mutex> lock(worker->lock);
+        
+        // Pinned tasks are executed in the order they were forked.
+        if (!worker->pinned.empty()) {
+            Task * task = worker->pinned.front();
+            worker->pinned.pop_front();
+            worker->pinned_count -= 1;
+            
+            return task;
+        }
+        
+        if (worker->tasks.empty())
+            return 0;
+        
+        Task * task = worker->tasks.back();
+        worker->tasks.pop_back();
+        _queued -= 1;
+        
+        return task;
+    }
+    
+    Scheduler::Task * Scheduler::steal(Worker * thief)
+    {
+        if (_queued == 0)
+            return 0;
+        
+        if (steal_seed == 0)
+            steal_seed = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+        
+        // xorshift64
+        steal_seed ^= steal_seed << 13;
+        steal_seed ^= steal_seed >> 7;
+        steal_seed ^= steal_seed << 17;
+        
+        // The submission queue is victim number _workers.size().
+        std::size_t count = _workers.size() + 1;
+        std::size_t offset = steal_seed % count;
+        
+        for (std::size_t i = 0; i < count; i += 1) {
+            std::size_t index = (offset + i) % count;
+            Worker * victim = index < _workers.size() ? _workers[index] : &_submissions;
+            
+            if (victim == thief)
+                continue;
+            
+            std::lock_guard<std::mutex> lock(victim->lock);
+            
+            if (!victim->tasks.empty()) {
+                Task * task = victim->tasks.front();
+                victim->tasks.pop_front();
+                _queued -= 1;
+                
+                return task;
+            }
+        }
+        
+        return 0;
+    }
+    
+    Scheduler::Task * Scheduler::find(Worker * worker)
+    {
+        if (worker) {
+            if (Task * task = pop(worker))
+                return task;
+        }
+        
+        return steal(worker);
+    }
+    
+    void Scheduler::execute(Task * task)
+    {
+        task->run();
+        
+        // The task may be destroyed by its joining thread as soon as it is complete, so we must not touch it again.
+        if (_joining > 0) {
+            std::lock_guard<std::mutex> lock(_idle_lock);
+            _completed.notify_all();
+        }
+    }
+    
+    void Scheduler::run(Worker * worker)
+    {
+        _current = worker;
+        
+#ifdef __linux__
+        if (worker->cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(worker->cpu, &cpus);
+            
+            // If this fails, e.g. because the CPU was taken away from the process, the worker still runs, but may migrate.
+            sched_setaffinity(0, sizeof(cpus), &cpus);
+        }
+#endif
+        
+        while (!_stopping) {
+            Task * task = 0;
+            
+            for (std::size_t i = 0; i < IDLE_SPIN_COUNT && !task; i += 1) {
+                task = find(worker);
+                
+                if (!task)
+                    std::this_thread::yield();
+            }
+            
+            if (task) {
+                execute(task);
+            } else {
+                std::unique_lock<std::mutex> lock(_idle_lock);
+                _sleeping += 1;
+                
+                while (_queued == 0 && worker->pinned_count == 0 && !_stopping)
+                    _available.wait(lock);
+                
+                _sleeping -= 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,168 @@
+//
+//  Scheduler.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_Scheduler_h
+#define DictionarySort_Scheduler_h
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ParallelMergeSort {
+    /** Work Stealing Scheduler.
+
+        A fixed set of worker threads, each with its own deque of tasks. A worker pushes and pops tasks at the back of its own deque (LIFO, so the most recently forked, and usually smallest, task runs next with warm caches), while idle workers steal from the front of other deques (FIFO, so thieves take the oldest and usually largest piece of work).
+
+        Tasks follow a strict fork/join discipline: a parent forks a child, does some work itself, and then joins the child. Joining never blocks the thread while there is work available - instead, the joining thread executes queued tasks (its own first, then stolen ones) until the child has completed. This means that a parent in the partition tree runs part of its subtree rather than sitting in std::thread::join().
+
+        Threads which are not workers (e.g. the thread calling ParallelMergeSort::sort) can also fork and join; their tasks are placed in a shared submission deque which every worker steals from.
+
+        A scheduler is intended to be long lived, so that back to back sorts share the same warm workers and pay no thread creation cost. Scheduler::shared() provides a process wide instance sized to the number of hardware threads.
+
+        On machines with more than one NUMA node, a scheduler can pin each worker to a CPU. Workers are numbered in order of their node, so that a contiguous range of workers shares the memory of one node, and a task can be forked to a particular worker, which is the only one that executes it (see sort_numa in NumaSort.h). Nodes are read from /sys/devices/system/node, or from libnuma if built with -DPARALLEL_MERGE_SORT_LIBNUMA=1. Elsewhere, every worker is on node 0 and pinning does nothing.
+
+     */
+    class Scheduler {
+    public:
+        // A unit of work which can be forked onto a scheduler and later joined. A task must outlive the call to join().
+        class Task {
+        protected:
+            std::atomic<bool> _complete;
+
+        public:
+            Task() : _complete(false) {}
+            virtual ~Task() {}
+
+            virtual void execute() = 0;
+
+            // Execute the task and mark it as complete.
+            void run() {
+                execute();
+                _complete.store(true);
+            }
+
+            bool complete() const {
+                return _complete.load();
+            }
+        };
+
+        // Adapts any functor (e.g. ParallelPartition) to a task.
+        template <typename FunctorT>
+        class FunctorTask : public Task {
+        protected:
+            FunctorT _functor;
+
+        public:
+            FunctorTask(const FunctorT & functor) : _functor(functor) {}
+
+            virtual void execute() {
+                _functor();
+            }
+        };
+
+        // Construct a scheduler with the given number of worker threads. If workers is zero, the number of hardware threads is used. If pinned is true, each worker is pinned to one of the CPUs which the process may run on, in order of their NUMA node.
+        explicit Scheduler(std::size_t workers = 0, bool pinned = false);
+        ~Scheduler();
+
+        // The number of worker threads available for executing tasks.
+        std::size_t concurrency() const { return _workers.size(); }
+
+        bool pinned() const { return _pinned; }
+
+        // The number of NUMA nodes which the workers are on, and the node of the given worker. If the workers are not pinned, they may run anywhere, so they are all on node 0.
+        std::size_t nodes() const { return _nodes; }
+        std::size_t node(std::size_t worker) const { return _workers[worker]->node; }
+
+        // Make a task available for execution by any worker.
+        void fork(Task & task);
+
+        // Make a task available for execution by the given worker only. The worker executes it before any other task, including while it is joining.
+        void fork(Task & task, std::size_t worker);
+
+        // Wait for a previously forked task to complete, executing other tasks in the mean time.
+        void join(Task & task);
+
+        // Fork every task but the first, execute the first on the calling thread, and then join the rest. Forked tasks must not move until they are joined, so the tasks are usually the elements of a std::deque.
+        template <typename TasksT>
+        void fork_join(TasksT & tasks) {
+            for (std::size_t i = 1; i < tasks.size(); i += 1)
+                fork(tasks[i]);
+
+            if (!tasks.empty())
+                tasks[0].execute();
+
+            for (std::size_t i = 1; i < tasks.size(); i += 1)
+                join(tasks[i]);
+        }
+
+        // As above, forking task i to worker first_worker + i * workers / tasks.size(), so that the tasks are spread evenly over the given workers.
+        template <typename TasksT>
+        void fork_join(TasksT & tasks, std::size_t first_worker, std::size_t workers) {
+            for (std::size_t i = 1; i < tasks.size(); i += 1)
+                fork(tasks[i], first_worker + i * workers / tasks.size());
+
+            if (!tasks.empty())
+                tasks[0].execute();
+
+            for (std::size_t i = 1; i < tasks.size(); i += 1)
+                join(tasks[i]);
+        }
+
+        // A process wide scheduler, created on first use, with one worker per hardware thread.
+        static Scheduler & shared();
+
+    private:
+        struct Worker {
+            Scheduler * scheduler;
+            std::mutex lock;
+            std::deque<Task*> tasks;
+            std::thread thread;
+
+            // Tasks which only this worker may execute, which are not counted in _queued.
+            std::deque<Task*> pinned;
+            std::atomic<std::size_t> pinned_count;
+
+            // The CPU which the worker is pinned to, or -1, and its NUMA node.
+            int cpu;
+            std::size_t node;
+        };
+
+        static thread_local Worker * _current;
+
+        Scheduler(const Scheduler &);
+        Scheduler & operator=(const Scheduler &);
+
+        // The worker running on the calling thread if it belongs to this scheduler, otherwise 0.
+        Worker * current() const;
+
+        // Pop from the back of our own deque, or steal from the front of another.
+        Task * pop(Worker * worker);
+        Task * steal(Worker * thief);
+        Task * find(Worker * worker);
+
+        void execute(Task * task);
+        void run(Worker * worker);
+
+        std::vector<Worker*> _workers;
+        Worker _submissions;
+
+        bool _pinned;
+        std::size_t _nodes;
+
+        // The number of tasks sitting in a deque, used to decide whether idle threads should go to sleep.
+        std::atomic<std::size_t> _queued;
+        std::atomic<bool> _stopping;
+
+        // Idle workers wait on _available, and threads joining a task which is running elsewhere wait on _completed.
+        std::mutex _idle_lock;
+        std::condition_variable _available, _completed;
+        std::atomic<std::size_t> _sleeping, _joining;
+    };
+}
+
+#endif
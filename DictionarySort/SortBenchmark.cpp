@@ -0,0 +1,633 @@
+//
+//  SortBenchmark.cpp
+//  DictionarySort
+//
+
+// Measure the sorts across input sizes, distributions and thread depths, e.g.:
+//
+//     $ SortBenchmark --sizes 1K,1M,100M --threaded 0,2,3 --csv results.csv --json results.json
+//
+// Every combination of keys, distribution and size is generated once, and each algorithm sorts it repeatedly. ParallelMergeSort is run at each thread depth n, i.e. with 2^n tasks, and std::sort and std::stable_sort are run for comparison, along with std::sort(std::execution::par) if it is enabled (see below) and the standard library provides it. Each sort is run a few times to warm up, and then the median and percentiles of the remaining runs are reported, so that a single slow run neither hides nor fakes a regression.
+//
+// Words are sorted by a Dictionary from a WordStore into a permutation, and the time includes generating the order of every word, as for SortWords. Integer keys are copied and then sorted in place, and the copy is not timed. Every result is checked, and if any sort is wrong, the benchmark fails.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// std::sort(std::execution::par) is only compared when built as C++17 with -DPARALLEL_MERGE_SORT_EXECUTION=1, since libstdc++ implements it using TBB, which must then also be linked with -ltbb.
+#if PARALLEL_MERGE_SORT_EXECUTION && __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<execution>)
+#include <execution>
+#endif
+#endif
+
+#include "Benchmark.h"
+#include "DictionarySort.h"
+
+typedef DictionarySort::Dictionary<char, DictionarySort::IndexT[256]> DictionaryT;
+typedef std::vector<long long> IntegersT;
+
+// The alphabet of the generated words.
+static const char * DEFAULT_ALPHABET = "AaBbCcDdEeFfGgHhIiJjKkLlMmNnOoPpQqRrSsTtUuVvWwXxYyZz";
+
+// Generated words have between 1 and this many letters, like the words in test_dictionary.
+static const std::size_t MAXIMUM_WORD_LENGTH = 25;
+
+// The length of the prefix shared by every word of the prefix distribution, which is longer than several segments of the order.
+static const std::size_t PREFIX_LENGTH = 64;
+
+// The number of distinct values of the few-unique distribution.
+static const std::size_t FEW_UNIQUE_COUNT = 16;
+
+// The zipf distribution chooses from at most this many distinct values, where the k-th most common value occurs with probability proportional to 1/k.
+static const std::size_t ZIPF_VALUE_COUNT = 1 << 20;
+
+static const char * KEYS[] = {"words", "integers"};
+static const char * DISTRIBUTIONS[] = {"uniform", "sorted", "reversed", "few-unique", "zipf", "prefix"};
+static const char * ALGORITHMS[] = {"parallel", "radix", "std::sort", "std::stable_sort", "std::sort(par)"};
+
+struct Options {
+    std::vector<std::size_t> sizes;
+    std::vector<std::size_t> threaded;
+    std::vector<std::string> keys;
+    std::vector<std::string> distributions;
+    std::vector<std::string> algorithms;
+    std::string alphabet;
+    std::size_t warmup, repetitions;
+    std::uint64_t seed;
+    std::string csv_path, json_path;
+};
+
+struct Statistics {
+    Benchmark::TimeT minimum, median, p90, p99, maximum, mean;
+};
+
+struct Result {
+    std::string keys, distribution, algorithm;
+    std::size_t count;
+
+    // The thread depth of ParallelMergeSort, or -1 for the other algorithms.
+    int threaded;
+
+    Statistics wall_time;
+    Benchmark::TimeT processor_time;
+    bool valid;
+};
+
+static std::vector<std::string> split (const std::string & text)
+{
+    std::vector<std::string> items;
+    std::istringstream input(text);
+    std::string item;
+
+    while (std::getline(input, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+
+    return items;
+}
+
+// Parse a count with an optional K, M or G suffix, which are powers of ten. Returns 0 if the count is not valid.
+static std::size_t parse_count (const std::string & text)
+{
+    char * end = 0;
+    std::size_t count = std::strtoull(text.c_str(), &end, 10);
+    std::string suffix = end;
+
+    if (suffix == "K")
+        return count * 1000;
+    else if (suffix == "M")
+        return count * 1000000;
+    else if (suffix == "G")
+        return count * 1000000000;
+    else if (suffix.empty())
+        return count;
+
+    return 0;
+}
+
+static bool parse_counts (const std::string & text, std::vector<std::size_t> & counts, bool allow_zero)
+{
+    counts.clear();
+
+    std::vector<std::string> items = split(text);
+
+    for (std::size_t i = 0; i < items.size(); i += 1) {
+        std::size_t count = parse_count(items[i]);
+
+        if (count == 0 && !(allow_zero && items[i] == "0"))
+            return false;
+
+        counts.push_back(count);
+    }
+
+    return !counts.empty();
+}
+
+template <std::size_t N>
+static bool parse_names (const std::string & text, const char * (&names)[N], std::vector<std::string> & selected)
+{
+    selected = split(text);
+
+    for (std::size_t i = 0; i < selected.size(); i += 1)
+        if (std::find(names, names + N, selected[i]) == names + N)
+            return false;
+
+    return !selected.empty();
+}
+
+static bool execution_supported ()
+{
+#if PARALLEL_MERGE_SORT_EXECUTION && defined(__cpp_lib_execution)
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Whether the algorithm can sort the given keys, e.g. std::sort(par) can't sort into a permutation via the dictionary.
+static bool supports (const std::string & algorithm, const std::string & keys)
+{
+    if (algorithm == "std::sort(par)")
+        return keys == "integers" && execution_supported();
+
+    return true;
+}
+
+// Shared prefixes make no difference to comparing integers, so only words have the prefix distribution.
+static bool supports_distribution (const std::string & distribution, const std::string & keys)
+{
+    return distribution != "prefix" || keys == "words";
+}
+
+/** Zipf Distribution.
+
+    Chooses an index in [0, count) where index k is chosen with probability proportional to 1/(k+1), by searching the cumulative distribution.
+
+ */
+class ZipfDistribution {
+public:
+    explicit ZipfDistribution(std::size_t count) : _cumulative(count) {
+        double total = 0;
+
+        for (std::size_t i = 0; i < count; i += 1) {
+            total += 1.0 / (i + 1);
+            _cumulative[i] = total;
+        }
+    }
+
+    std::size_t operator()(std::mt19937_64 & random) const {
+        double target = std::uniform_real_distribution<double>(0, _cumulative.back())(random);
+
+        return std::min<std::size_t>(std::upper_bound(_cumulative.begin(), _cumulative.end(), target) - _cumulative.begin(), _cumulative.size() - 1);
+    }
+
+private:
+    std::vector<double> _cumulative;
+};
+
+// Generate count values from the given distribution, making each distinct value using random_value and appending it using output. The sorted and reversed distributions are generated as uniform, and ordered by the caller.
+template <typename ValueT, typename RandomValueT, typename OutputT>
+static void generate (const std::string & distribution, std::size_t count, std::mt19937_64 & random, RandomValueT random_value, OutputT output)
+{
+    if (distribution == "few-unique" || distribution == "zipf") {
+        std::vector<ValueT> values(distribution == "zipf" ? std::min(count, ZIPF_VALUE_COUNT) : FEW_UNIQUE_COUNT);
+
+        for (std::size_t i = 0; i < values.size(); i += 1)
+            values[i] = random_value();
+
+        if (distribution == "zipf") {
+            ZipfDistribution zipf(values.size());
+
+            for (std::size_t i = 0; i < count; i += 1)
+                output(values[zipf(random)]);
+        } else {
+            std::uniform_int_distribution<std::size_t> index(0, values.size() - 1);
+
+            for (std::size_t i = 0; i < count; i += 1)
+                output(values[index(random)]);
+        }
+    } else {
+        for (std::size_t i = 0; i < count; i += 1)
+            output(random_value());
+    }
+}
+
+static void generate_integers (const std::string & distribution, std::size_t count, std::mt19937_64 & random, IntegersT & integers)
+{
+    integers.clear();
+    integers.reserve(count);
+
+    generate<long long>(distribution, count, random,
+        [&]() { return (long long)random(); },
+        [&](long long value) { integers.push_back(value); }
+    );
+
+    if (distribution == "sorted" || distribution == "reversed")
+        std::sort(integers.begin(), integers.end());
+
+    if (distribution == "reversed")
+        std::reverse(integers.begin(), integers.end());
+}
+
+static void generate_words (const std::string & distribution, std::size_t count, std::mt19937_64 & random, const std::string & alphabet, DictionaryT & dictionary, DictionaryT::WordStoreT & store)
+{
+    std::uniform_int_distribution<std::size_t> length(1, MAXIMUM_WORD_LENGTH), letter(0, alphabet.size() - 1);
+
+    std::string prefix;
+
+    if (distribution == "prefix")
+        for (std::size_t i = 0; i < PREFIX_LENGTH; i += 1)
+            prefix += alphabet[letter(random)];
+
+    store.clear();
+
+    generate<std::string>(distribution, count, random,
+        [&]() {
+            std::string word = prefix;
+
+            for (std::size_t i = length(random); i > 0; i -= 1)
+                word += alphabet[letter(random)];
+
+            return word;
+        },
+        [&](const std::string & word) { store.push_back(word.data(), word.data() + word.size()); }
+    );
+
+    if (distribution == "sorted" || distribution == "reversed") {
+        DictionaryT::PermutationT permutation;
+        dictionary.sort(store, permutation, -1);
+
+        if (distribution == "reversed")
+            std::reverse(permutation.begin(), permutation.end());
+
+        DictionaryT::WordStoreT ordered;
+
+        for (std::size_t i = 0; i < permutation.size(); i += 1) {
+            DictionaryT::WordStoreT::Word word = store[permutation[i]];
+            ordered.push_back(word.begin(), word.end());
+        }
+
+        std::swap(store, ordered);
+    }
+}
+
+// Sorts integers by their value, flipping the sign bit so that negative values come first.
+struct IntegerKey {
+    std::size_t size(const long long &) const { return 1; }
+    std::uint64_t operator()(const long long & value, std::size_t) const { return std::uint64_t(value) ^ (std::uint64_t(1) << 63); }
+};
+
+static void sort_integers (const std::string & algorithm, std::size_t threaded, IntegersT & integers)
+{
+    std::less<long long> comparator;
+
+    if (algorithm == "parallel") {
+        ParallelMergeSort::sort(integers, comparator, threaded);
+    } else if (algorithm == "radix") {
+        ParallelMergeSort::radix_sort(integers.begin(), integers.end(), IntegerKey(), comparator, ParallelMergeSort::Scheduler::shared());
+    } else if (algorithm == "std::sort") {
+        std::sort(integers.begin(), integers.end(), comparator);
+    } else if (algorithm == "std::stable_sort") {
+        std::stable_sort(integers.begin(), integers.end(), comparator);
+    } else {
+#if PARALLEL_MERGE_SORT_EXECUTION && defined(__cpp_lib_execution)
+        std::sort(std::execution::par, integers.begin(), integers.end(), comparator);
+#endif
+    }
+}
+
+// The sum and sum of squares of the values, which are the same for any permutation of them.
+static std::pair<std::uint64_t, std::uint64_t> fingerprint (const IntegersT & integers)
+{
+    std::pair<std::uint64_t, std::uint64_t> sums(0, 0);
+
+    for (std::size_t i = 0; i < integers.size(); i += 1) {
+        std::uint64_t value = integers[i];
+
+        sums.first += value;
+        sums.second += value * value;
+    }
+
+    return sums;
+}
+
+// The dictionary sort modes for each algorithm, see SORT_MODE.
+static int sort_mode (const std::string & algorithm, std::size_t threaded)
+{
+    if (algorithm == "radix")
+        return -2;
+    else if (algorithm == "std::sort")
+        return -1;
+    else if (algorithm == "std::stable_sort")
+        return -3;
+
+    return threaded;
+}
+
+static Benchmark::TimeT percentile (const std::vector<Benchmark::TimeT> & sorted, double fraction)
+{
+    double position = fraction * (sorted.size() - 1);
+    std::size_t index = position;
+
+    if (index + 1 >= sorted.size())
+        return sorted.back();
+
+    return sorted[index] + (sorted[index + 1] - sorted[index]) * (position - index);
+}
+
+static Statistics statistics (std::vector<Benchmark::TimeT> times)
+{
+    std::sort(times.begin(), times.end());
+
+    Benchmark::TimeT total = 0;
+
+    for (std::size_t i = 0; i < times.size(); i += 1)
+        total += times[i];
+
+    return {times.front(), percentile(times, 0.5), percentile(times, 0.9), percentile(times, 0.99), times.back(), total / times.size()};
+}
+
+// Run the sort warmup + repetitions times, where run sorts once, fills in the time it took and returns whether the result was correct.
+template <typename RunT>
+static void measure (const Options & options, RunT run, Result & result)
+{
+    std::vector<Benchmark::TimeT> wall_times, processor_times;
+
+    result.valid = true;
+
+    for (std::size_t i = 0; i < options.warmup + options.repetitions; i += 1) {
+        Benchmark::Timer::Sample sample;
+
+        if (!run(sample))
+            result.valid = false;
+
+        if (i >= options.warmup) {
+            wall_times.push_back(sample.wall_time_total);
+            processor_times.push_back(sample.processor_time_total);
+        }
+    }
+
+    result.wall_time = statistics(wall_times);
+    result.processor_time = statistics(processor_times).median;
+}
+
+static void report (const Result & result)
+{
+    std::cerr << std::left << std::setw(9) << result.keys << std::setw(11) << result.distribution << std::right << std::setw(10) << result.count << "  " << std::left << std::setw(17) << result.algorithm;
+    std::cerr << std::right << std::setw(3);
+
+    if (result.threaded >= 0)
+        std::cerr << result.threaded;
+    else
+        std::cerr << "-";
+
+    std::cerr << std::fixed << std::setprecision(6) << "  median " << result.wall_time.median << "s  p90 " << result.wall_time.p90 << "s  min " << result.wall_time.minimum << "s";
+    std::cerr << std::defaultfloat << std::setprecision(3) << "  " << result.count / result.wall_time.median << " items/s";
+
+    if (!result.valid)
+        std::cerr << "  INVALID";
+
+    std::cerr << std::endl;
+}
+
+static void write_csv (std::ostream & output, const std::vector<Result> & results)
+{
+    output << "keys,distribution,count,algorithm,threaded,minimum,median,p90,p99,maximum,mean,processor_median,items_per_second,valid" << std::endl;
+    output << std::setprecision(9);
+
+    for (std::size_t i = 0; i < results.size(); i += 1) {
+        const Result & result = results[i];
+
+        output << result.keys << "," << result.distribution << "," << result.count << "," << result.algorithm << ",";
+
+        if (result.threaded >= 0)
+            output << result.threaded;
+
+        output << "," << result.wall_time.minimum << "," << result.wall_time.median << "," << result.wall_time.p90 << "," << result.wall_time.p99 << "," << result.wall_time.maximum << "," << result.wall_time.mean;
+        output << "," << result.processor_time << "," << result.count / result.wall_time.median << "," << (result.valid ? "true" : "false") << std::endl;
+    }
+}
+
+static void write_json (std::ostream & output, const Options & options, const std::vector<Result> & results)
+{
+    output << std::setprecision(9);
+    output << "{" << std::endl;
+    output << "  \"concurrency\": " << ParallelMergeSort::Scheduler::shared().concurrency() << "," << std::endl;
+    output << "  \"vector_kernels\": \"" << DictionarySort::SIMD::kernels().name << "\"," << std::endl;
+    output << "  \"warmup\": " << options.warmup << "," << std::endl;
+    output << "  \"repetitions\": " << options.repetitions << "," << std::endl;
+    output << "  \"seed\": " << options.seed << "," << std::endl;
+    output << "  \"results\": [";
+
+    for (std::size_t i = 0; i < results.size(); i += 1) {
+        const Result & result = results[i];
+
+        output << (i ? "," : "") << std::endl << "    {";
+        output << "\"keys\": \"" << result.keys << "\", \"distribution\": \"" << result.distribution << "\", \"count\": " << result.count << ", \"algorithm\": \"" << result.algorithm << "\", \"threaded\": ";
+
+        if (result.threaded >= 0)
+            output << result.threaded;
+        else
+            output << "null";
+
+        output << ", \"wall_time\": {\"minimum\": " << result.wall_time.minimum << ", \"median\": " << result.wall_time.median << ", \"p90\": " << result.wall_time.p90 << ", \"p99\": " << result.wall_time.p99 << ", \"maximum\": " << result.wall_time.maximum << ", \"mean\": " << result.wall_time.mean << "}";
+        output << ", \"processor_median\": " << result.processor_time << ", \"items_per_second\": " << result.count / result.wall_time.median << ", \"valid\": " << (result.valid ? "true" : "false") << "}";
+    }
+
+    output << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+
+// Write to the given path, or to stdout if the path is "-".
+template <typename WriteT>
+static bool write_file (const std::string & path, WriteT write)
+{
+    if (path == "-") {
+        write(std::cout);
+        return bool(std::cout);
+    }
+
+    std::ofstream output(path.c_str());
+    write(output);
+    output.close();
+
+    return bool(output);
+}
+
+static void run_benchmark (const Options & options, std::vector<Result> & results)
+{
+    std::string alphabet = options.alphabet;
+    DictionaryT dictionary(DictionaryT::WordT(alphabet.begin(), alphabet.end()));
+    dictionary.set_verbose(false);
+
+    std::mt19937_64 random(options.seed);
+
+    for (std::size_t k = 0; k < options.keys.size(); k += 1) {
+        const std::string & keys = options.keys[k];
+
+        for (std::size_t d = 0; d < options.distributions.size(); d += 1) {
+            const std::string & distribution = options.distributions[d];
+
+            if (!supports_distribution(distribution, keys))
+                continue;
+
+            for (std::size_t s = 0; s < options.sizes.size(); s += 1) {
+                std::size_t count = options.sizes[s];
+
+                DictionaryT::WordStoreT store;
+                DictionaryT::PermutationT permutation;
+                IntegersT input, integers;
+
+                std::uint64_t expected_checksum = 0;
+                std::pair<std::uint64_t, std::uint64_t> expected_fingerprint;
+
+                if (keys == "words") {
+                    generate_words(distribution, count, random, alphabet, dictionary, store);
+                    expected_checksum = dictionary.sort(store, permutation, -1);
+                } else {
+                    generate_integers(distribution, count, random, input);
+                    expected_fingerprint = fingerprint(input);
+                }
+
+                for (std::size_t a = 0; a < options.algorithms.size(); a += 1) {
+                    const std::string & algorithm = options.algorithms[a];
+
+                    if (!supports(algorithm, keys))
+                        continue;
+
+                    // Only ParallelMergeSort has a thread depth.
+                    std::vector<int> depths(1, -1);
+
+                    if (algorithm == "parallel")
+                        depths.assign(options.threaded.begin(), options.threaded.end());
+
+                    for (std::size_t t = 0; t < depths.size(); t += 1) {
+                        Result result = {keys, distribution, algorithm, count, depths[t], Statistics(), 0, false};
+
+                        if (keys == "words") {
+                            int mode = sort_mode(algorithm, depths[t]);
+
+                            measure(options, [&](Benchmark::Timer::Sample & sample) {
+                                Benchmark::Timer timer;
+                                std::uint64_t checksum = dictionary.sort(store, permutation, mode);
+                                sample = timer.sample();
+
+                                return checksum == expected_checksum && permutation.size() == count;
+                            }, result);
+                        } else {
+                            measure(options, [&](Benchmark::Timer::Sample & sample) {
+                                integers = input;
+
+                                Benchmark::Timer timer;
+                                sort_integers(algorithm, depths[t], integers);
+                                sample = timer.sample();
+
+                                return std::is_sorted(integers.begin(), integers.end()) && fingerprint(integers) == expected_fingerprint;
+                            }, result);
+                        }
+
+                        report(result);
+                        results.push_back(result);
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main (int argc, const char * argv[])
+{
+    Options options = {
+        {1000, 10000, 100000, 1000000},
+        {0, 1, 2, 3},
+        std::vector<std::string>(KEYS, KEYS + 2),
+        std::vector<std::string>(DISTRIBUTIONS, DISTRIBUTIONS + 6),
+        std::vector<std::string>(ALGORITHMS, ALGORITHMS + 5),
+        DEFAULT_ALPHABET,
+        1, 5,
+        1,
+        "", ""
+    };
+
+    bool valid = true;
+
+    for (int i = 1; i < argc && valid; i += 1) {
+        std::string argument = argv[i];
+
+        if (argument == "--sizes" && i+1 < argc) {
+            valid = parse_counts(argv[++i], options.sizes, false);
+        } else if (argument == "--threaded" && i+1 < argc) {
+            valid = parse_counts(argv[++i], options.threaded, true);
+        } else if (argument == "--keys" && i+1 < argc) {
+            valid = parse_names(argv[++i], KEYS, options.keys);
+        } else if (argument == "--distributions" && i+1 < argc) {
+            valid = parse_names(argv[++i], DISTRIBUTIONS, options.distributions);
+        } else if (argument == "--algorithms" && i+1 < argc) {
+            valid = parse_names(argv[++i], ALGORITHMS, options.algorithms);
+        } else if (argument == "--alphabet" && i+1 < argc) {
+            options.alphabet = argv[++i];
+            valid = !options.alphabet.empty();
+        } else if (argument == "--warmup" && i+1 < argc) {
+            std::string text = argv[++i];
+            options.warmup = parse_count(text);
+            valid = options.warmup > 0 || text == "0";
+        } else if (argument == "--repetitions" && i+1 < argc) {
+            options.repetitions = parse_count(argv[++i]);
+            valid = options.repetitions > 0;
+        } else if (argument == "--seed" && i+1 < argc) {
+            options.seed = std::strtoull(argv[++i], 0, 10);
+        } else if (argument == "--csv" && i+1 < argc) {
+            options.csv_path = argv[++i];
+        } else if (argument == "--json" && i+1 < argc) {
+            options.json_path = argv[++i];
+        } else {
+            valid = false;
+        }
+    }
+
+    if (!valid) {
+        std::cerr << "Usage: " << argv[0] << " [--sizes 1K,1M,...] [--threaded 0,1,...] [--keys words,integers] [--distributions uniform,sorted,reversed,few-unique,zipf,prefix] [--algorithms parallel,radix,std::sort,std::stable_sort,std::sort(par)] [--alphabet letters] [--warmup n] [--repetitions n] [--seed n] [--csv path] [--json path]" << std::endl;
+        std::cerr << "Sizes may have a K, M or G suffix, which are powers of ten. Each thread depth n runs ParallelMergeSort with 2^n tasks. Results are written as CSV or JSON to the given paths, or to stdout for -." << std::endl;
+        return 1;
+    }
+
+    std::cerr << "Scheduler worker count: " << ParallelMergeSort::Scheduler::shared().concurrency() << std::endl;
+    std::cerr << "Vector kernels = " << DictionarySort::SIMD::kernels().name << std::endl;
+
+    if (!execution_supported())
+        std::cerr << "std::execution is not enabled, skipping std::sort(par). Build as C++17 with -DPARALLEL_MERGE_SORT_EXECUTION=1 -ltbb to include it." << std::endl;
+
+    std::cerr << "Warmup " << options.warmup << ", repetitions " << options.repetitions << ", seed " << options.seed << std::endl;
+
+    std::vector<Result> results;
+    run_benchmark(options, results);
+
+    int status = 0;
+
+    for (std::size_t i = 0; i < results.size(); i += 1) {
+        if (!results[i].valid) {
+            std::cerr << "Invalid result: " << results[i].algorithm << " sorting " << results[i].count << " " << results[i].distribution << " " << results[i].keys << "!" << std::endl;
+            status = 1;
+        }
+    }
+
+    if (!options.csv_path.empty() && !write_file(options.csv_path, [&](std::ostream & output) { write_csv(output, results); })) {
+        std::cerr << "Could not write " << options.csv_path << std::endl;
+        status = 1;
+    }
+
+    if (!options.json_path.empty() && !write_file(options.json_path, [&](std::ostream & output) { write_json(output, options, results); })) {
+        std::cerr << "Could not write " << options.json_path << std::endl;
+        status = 1;
+    }
+
+    return status;
+}
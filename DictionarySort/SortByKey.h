@@ -0,0 +1,216 @@
+//
+//  SortByKey.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_SortByKey_h
+#define DictionarySort_SortByKey_h
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "ParallelMergeSort.h"
+
+namespace ParallelMergeSort {
+    /** Key-Value Sort.
+
+        To sort records by a key, we can either sort the records themselves, which moves every byte of every record at each level of the tree, or sort pointers to them, which costs a cache miss for every comparison. Instead, sort_by_key sorts a dense array of keys, and moves the matching item of a second array of values (e.g. the records themselves, or 32-bit indices of them) alongside each key:
+
+            std::vector<std::uint64_t> keys = ...;
+            std::vector<std::uint32_t> indices = ...;
+
+            ParallelMergeSort::sort_by_key(keys, indices, std::less<std::uint64_t>());
+
+        The two arrays are sorted as one sequence of KeyValueIterator, so the partition tree, the merge path and the scheduler are exactly those used by sort. Comparisons only ever read the keys, and the merge kernel for key-value items reads both arrays sequentially, so each level of the tree streams the keys and values once, and the values are never loaded to decide the order.
+
+        The sort is stable: values whose keys compare equal keep their relative order. The base case is binary insertion sort (key-value items are never arithmetic, so sorting networks are never used), the merge kernels take ties from the lower sequence first, as does the co-rank which splits parallel merges, and merges which are already in order are only skipped if the first item of the upper sequence is not less than the last item of the lower sequence. This holds for DefaultPolicy as well as StablePolicy, so stable multi-pass sorts can be built from it, e.g. sorting by a secondary key and then by the primary key.
+
+     */
+
+    // The item which a KeyValueIterator refers to, when it is moved out of the arrays, e.g. by insertion sort.
+    template <typename KeyT, typename ValueT>
+    struct KeyValue {
+        KeyT key;
+        ValueT value;
+    };
+
+    // A reference to a key and its value in two separate arrays. Assigning to it assigns to both items, rather than rebinding it.
+    template <typename KeyT, typename ValueT>
+    struct KeyValueReference {
+        typedef KeyValue<KeyT, ValueT> KeyValueT;
+
+        KeyT & key;
+        ValueT & value;
+
+        KeyValueReference(KeyT & _key, ValueT & _value)
+            : key(_key), value(_value)
+        {
+        }
+
+        KeyValueReference(const KeyValueReference & other) = default;
+
+        const KeyValueReference & operator=(const KeyValueReference & other) const {
+            key = other.key;
+            value = other.value;
+
+            return *this;
+        }
+
+        const KeyValueReference & operator=(KeyValueReference && other) const {
+            key = std::move(other.key);
+            value = std::move(other.value);
+
+            return *this;
+        }
+
+        const KeyValueReference & operator=(KeyValueT && other) const {
+            key = std::move(other.key);
+            value = std::move(other.value);
+
+            return *this;
+        }
+
+        const KeyValueReference & operator=(const KeyValueT & other) const {
+            key = other.key;
+            value = other.value;
+
+            return *this;
+        }
+
+        // Moving a reference moves the items it refers to, so a moved reference converts by moving too, e.g. ValueT value = std::move(array[offset]) in insertion_sort.
+        operator KeyValueT() const & {
+            KeyValueT item = {key, value};
+            return item;
+        }
+
+        operator KeyValueT() && {
+            KeyValueT item = {std::move(key), std::move(value)};
+            return item;
+        }
+
+        friend void swap(KeyValueReference a, KeyValueReference b) {
+            using std::swap;
+
+            swap(a.key, b.key);
+            swap(a.value, b.value);
+        }
+    };
+
+    // A random access iterator over a key array and a value array in parallel. The arrays may be any random access iterators, e.g. a vector of keys and a raw array of indices.
+    template <typename KeyIteratorT, typename ValueIteratorT>
+    struct KeyValueIterator {
+        typedef typename std::iterator_traits<KeyIteratorT>::value_type KeyT;
+        typedef typename std::iterator_traits<ValueIteratorT>::value_type ValueT;
+
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef KeyValue<KeyT, ValueT> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef KeyValueReference<KeyT, ValueT> reference;
+        typedef void pointer;
+
+        KeyIteratorT keys;
+        ValueIteratorT values;
+
+        reference operator*() const { return reference(*keys, *values); }
+        reference operator[](difference_type offset) const { return reference(keys[offset], values[offset]); }
+
+        KeyValueIterator & operator++() { ++keys; ++values; return *this; }
+        KeyValueIterator & operator--() { --keys; --values; return *this; }
+        KeyValueIterator operator++(int) { KeyValueIterator copy = *this; ++*this; return copy; }
+        KeyValueIterator operator--(int) { KeyValueIterator copy = *this; --*this; return copy; }
+
+        KeyValueIterator & operator+=(difference_type offset) { keys += offset; values += offset; return *this; }
+        KeyValueIterator & operator-=(difference_type offset) { keys -= offset; values -= offset; return *this; }
+
+        KeyValueIterator operator+(difference_type offset) const { KeyValueIterator copy = *this; return copy += offset; }
+        KeyValueIterator operator-(difference_type offset) const { KeyValueIterator copy = *this; return copy -= offset; }
+        friend KeyValueIterator operator+(difference_type offset, const KeyValueIterator & iterator) { return iterator + offset; }
+
+        difference_type operator-(const KeyValueIterator & other) const { return keys - other.keys; }
+
+        bool operator==(const KeyValueIterator & other) const { return keys == other.keys; }
+        bool operator!=(const KeyValueIterator & other) const { return keys != other.keys; }
+        bool operator<(const KeyValueIterator & other) const { return keys < other.keys; }
+        bool operator>(const KeyValueIterator & other) const { return keys > other.keys; }
+        bool operator<=(const KeyValueIterator & other) const { return keys <= other.keys; }
+        bool operator>=(const KeyValueIterator & other) const { return keys >= other.keys; }
+    };
+
+    template <typename KeyIteratorT, typename ValueIteratorT>
+    KeyValueIterator<KeyIteratorT, ValueIteratorT> key_value_iterator(KeyIteratorT keys, ValueIteratorT values) {
+        KeyValueIterator<KeyIteratorT, ValueIteratorT> iterator = {keys, values};
+
+        return iterator;
+    }
+
+    // Compares key-value items by their keys only.
+    template <typename ComparatorT>
+    struct CompareKeys {
+        const ComparatorT & comparator;
+
+        template <typename LeftT, typename RightT>
+        bool operator()(const LeftT & a, const RightT & b) const {
+            return comparator(a.key, b.key);
+        }
+    };
+
+    // Merges the key and value arrays directly rather than through references. The next item is chosen by index, so only the comparison depends on the keys, and for cheap comparators (e.g. std::less of arithmetic keys) the loop compiles without branching on it. Ties are taken from the left first.
+    template <typename ComparatorT, typename KeyT, typename ValueT>
+    struct MergeKernel<CompareKeys<ComparatorT>, KeyValue<KeyT, ValueT>, false> {
+        template <typename SourceT, typename DestinationT>
+        static void merge(SourceT source, DestinationT destination, const CompareKeys<ComparatorT> & comparator, std::size_t left, std::size_t left_end, std::size_t right, std::size_t right_end, std::size_t offset) {
+            while (left < left_end && right < right_end) {
+                bool take_right = comparator.comparator(source.keys[right], source.keys[left]);
+                std::size_t next = take_right ? right : left;
+
+                destination.keys[offset] = std::move(source.keys[next]);
+                destination.values[offset] = std::move(source.values[next]);
+
+                offset += 1;
+                left += !take_right;
+                right += take_right;
+            }
+
+            std::move(source + left, source + left_end, destination + offset);
+            std::move(source + right, source + right_end, destination + offset + (left_end - left));
+        }
+    };
+
+    /** Key-Value Sort, main entry point.
+
+        Sort the keys [keys_begin, keys_end] along with the same number of values starting at values, using scratch buffers of at least as many keys and values, which are overwritten. Equal keys keep their relative order.
+
+     */
+    template <typename PolicyT = DefaultPolicy, typename KeyIteratorT, typename ValueIteratorT, typename ComparatorT, typename KeyScratchT, typename ValueScratchT>
+    void sort_by_key(KeyIteratorT keys_begin, KeyIteratorT keys_end, ValueIteratorT values, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler, KeyScratchT key_scratch, ValueScratchT value_scratch) {
+        CompareKeys<ComparatorT> compare_keys = {comparator};
+
+        sort<PolicyT>(key_value_iterator(keys_begin, values), key_value_iterator(keys_end, values + (keys_end - keys_begin)), compare_keys, configuration, scheduler, key_value_iterator(key_scratch, value_scratch));
+    }
+
+    // As above, allocating scratch buffers of default constructed keys and values.
+    template <typename PolicyT = DefaultPolicy, typename KeyIteratorT, typename ValueIteratorT, typename ComparatorT>
+    void sort_by_key(KeyIteratorT keys_begin, KeyIteratorT keys_end, ValueIteratorT values, const ComparatorT & comparator, const Configuration & configuration, Scheduler & scheduler) {
+        std::vector<typename std::iterator_traits<KeyIteratorT>::value_type> key_scratch(keys_end - keys_begin);
+        std::vector<typename std::iterator_traits<ValueIteratorT>::value_type> value_scratch(keys_end - keys_begin);
+
+        sort_by_key<PolicyT>(keys_begin, keys_end, values, comparator, configuration, scheduler, key_scratch.begin(), value_scratch.begin());
+    }
+
+    // Sort two whole containers of the same size, using the default cutoffs and parallelising the top threaded levels of the tree.
+    template <typename PolicyT = DefaultPolicy, typename KeysT, typename ValuesT, typename ComparatorT>
+    void sort_by_key(KeysT & keys, ValuesT & values, const ComparatorT & comparator, std::size_t threaded, Scheduler & scheduler) {
+        sort_by_key<PolicyT>(keys.begin(), keys.end(), values.begin(), comparator, Configuration(threaded, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT), scheduler);
+    }
+
+    // As above, using the process wide scheduler.
+    template <typename PolicyT = DefaultPolicy, typename KeysT, typename ValuesT, typename ComparatorT>
+    void sort_by_key(KeysT & keys, ValuesT & values, const ComparatorT & comparator, std::size_t threaded = 2) {
+        sort_by_key<PolicyT>(keys, values, comparator, threaded, Scheduler::shared());
+    }
+}
+
+#endif
@@ -0,0 +1,345 @@
+//
+//  SortWords.cpp
+//  DictionarySort
+//
+
+// Sort a file with one word per line, e.g.:
+//
+//     $ SortWords --alphabet abcdefghijklmnopqrstuvwxyz --output sorted.txt words.txt
+//
+// The input file is memory mapped and the words are never copied: the store indexes the lines in place, and the output is written using vectored writes which point directly into the mapped file.
+//
+// Files which are larger than memory can be sorted within a memory budget, see ExternalSort:
+//
+//     $ SortWords --memory 4G --temporary /scratch --output sorted.txt words.txt
+//
+// With --utf8, the alphabet and the input are UTF-8, and each letter of the alphabet may be any Unicode character:
+//
+//     $ SortWords --utf8 --alphabet АаБбВвГгДдЕеЁёЖжЗзИиЙйКкЛлМмНнОоПпРрСсТтУуФфХхЦцЧчШшЩщЪъЫыЬьЭэЮюЯя words.txt
+//
+// With --first, only the first n words in sorted order are written, using a partial sort which is much faster than sorting the whole file:
+//
+//     $ SortWords --first 100 words.txt
+//
+// With --unique, each distinct word is only written once, and duplicates are removed while sorting rather than afterwards:
+//
+//     $ SortWords --unique corpus.txt
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "Benchmark.h"
+#include "DictionarySort.h"
+#include "ExternalSort.h"
+#include "MappedFile.h"
+
+// Both dictionaries sort lines of bytes, so they share the same store.
+typedef DictionarySort::WordStore<char> WordStoreT;
+typedef std::vector<WordStoreT::WordIndexT> PermutationT;
+
+// The alphabet used when none is given.
+static const char * DEFAULT_ALPHABET = "AaBbCcDdEeFfGgHhIiJjKkLlMmNnOoPpQqRrSsTtUuVvWwXxYyZz";
+
+// The maximum number of lines written by each call to writev.
+static const long WRITE_VECTOR_COUNT = 1024;
+
+// Write all of the given vectors, retrying after partial writes.
+static bool write_vectors (int descriptor, struct iovec * vectors, int count)
+{
+    while (count > 0) {
+        ssize_t written = writev(descriptor, vectors, count);
+
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+
+            return false;
+        }
+
+        // Skip the vectors which were completely written, and advance into the first one which wasn't.
+        while (count > 0 && std::size_t(written) >= vectors->iov_len) {
+            written -= vectors->iov_len;
+            ++vectors;
+            --count;
+        }
+
+        if (count > 0) {
+            vectors->iov_base = (char *)vectors->iov_base + written;
+            vectors->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+// Write the words of the store in the order given by the permutation, one per line. Lines which are next to each other in the store are written as a single vector.
+static bool write_lines (int descriptor, const WordStoreT & store, const PermutationT & permutation)
+{
+    long limit = sysconf(_SC_IOV_MAX);
+    int capacity = int(limit > 0 ? std::min(limit, WRITE_VECTOR_COUNT) : 16);
+
+    std::vector<struct iovec> vectors(capacity);
+    int count = 0;
+
+    static char delimiter = '\n';
+
+    for (std::size_t i = 0; i < permutation.size(); i += 1) {
+        WordStoreT::Word line = store.line(permutation[i]);
+
+        if (count > 0 && (const char *)vectors[count-1].iov_base + vectors[count-1].iov_len == line.begin()) {
+            vectors[count-1].iov_len += line.size();
+        } else {
+            if (count == capacity) {
+                if (!write_vectors(descriptor, vectors.data(), count))
+                    return false;
+
+                count = 0;
+            }
+
+            vectors[count].iov_base = (void *)line.begin();
+            vectors[count].iov_len = line.size();
+            count += 1;
+        }
+
+        // The last line of the file may not have a delimiter.
+        if (line.size() == 0 || line.end()[-1] != delimiter) {
+            if (count == capacity) {
+                if (!write_vectors(descriptor, vectors.data(), count))
+                    return false;
+
+                count = 0;
+            }
+
+            vectors[count].iov_base = &delimiter;
+            vectors[count].iov_len = 1;
+            count += 1;
+        }
+    }
+
+    return write_vectors(descriptor, vectors.data(), count);
+}
+
+// Parse a number of bytes with an optional K, M or G suffix. Returns 0 if the size is not valid.
+static std::size_t parse_size (const std::string & text)
+{
+    char * end = 0;
+    std::size_t size = std::strtoull(text.c_str(), &end, 10);
+    std::string suffix = end;
+
+    if (suffix == "K")
+        return size << 10;
+    else if (suffix == "M")
+        return size << 20;
+    else if (suffix == "G")
+        return size << 30;
+    else if (suffix.empty())
+        return size;
+
+    return 0;
+}
+
+static bool read_file (const std::string & path, std::string & contents)
+{
+    std::ifstream input(path.c_str(), std::ios::binary);
+
+    if (!input)
+        return false;
+
+    contents.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+
+    return true;
+}
+
+// Every letter of a UTF-8 alphabet must be a valid character. Invalid sequences in the input are allowed, and are ordered like any other character which is not in the alphabet.
+static bool valid_utf8 (const std::string & text)
+{
+    const char * begin = text.data(), * end = begin + text.size();
+
+    while (begin != end) {
+        if (DictionarySort::decode_utf8(begin, end) == DictionarySort::INVALID_CODEPOINT)
+            return false;
+    }
+
+    return true;
+}
+
+struct Options {
+    std::string alphabet, input_path, output_path, profile_path, temporary_directory;
+    std::size_t memory_budget;
+
+    // If not zero, only the first words in sorted order are written.
+    std::size_t first;
+
+    // Write each distinct word once.
+    bool unique;
+};
+
+// Sort the input with a dictionary using the given character order map, e.g. DictionarySort::IndexT[256] for single byte letters, or DictionarySort::UTF8Table for UTF-8.
+template <typename MapT>
+static int sort_file (const Options & options)
+{
+    typedef DictionarySort::Dictionary<char, MapT> DictionaryT;
+
+    ParallelMergeSort::Scheduler & scheduler = ParallelMergeSort::Scheduler::shared();
+    DictionaryT dictionary(typename DictionaryT::WordT(options.alphabet.begin(), options.alphabet.end()));
+
+    if (!options.profile_path.empty()) {
+        ParallelMergeSort::Profile profile;
+
+        if (!profile.load(options.profile_path)) {
+            std::cerr << "Could not load profile from " << options.profile_path << std::endl;
+            return 1;
+        }
+
+        dictionary.set_profile(profile);
+    }
+
+    Benchmark::WallTime load_time;
+
+    DictionarySort::MappedFile input;
+    if (!input.open(options.input_path)) {
+        std::cerr << "Could not map " << options.input_path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    int output = STDOUT_FILENO;
+    if (!options.output_path.empty()) {
+        output = open(options.output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (output == -1) {
+            std::cerr << "Could not open " << options.output_path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+
+    bool written = true;
+
+    if (options.memory_budget) {
+        try {
+            Benchmark::WallTime sort_time;
+            DictionarySort::ExternalSort<char, MapT> external_sort(dictionary, options.memory_budget, options.temporary_directory);
+            std::size_t runs = external_sort.sort(input, output);
+
+            std::cerr << "Sorted " << runs << " runs in " << sort_time.total() << "s" << std::endl;
+        } catch (std::exception & error) {
+            std::cerr << "External sort failed: " << error.what() << std::endl;
+            return 1;
+        }
+    } else {
+        // The whole file is read by the scan, and then again in sorted order while generating the order of each word.
+        input.will_need(input.begin(), input.end());
+
+        WordStoreT store;
+        store.reference(input.begin(), input.end(), scheduler);
+
+        std::cerr << "Loaded " << store.size() << " words in " << load_time.total() << "s" << std::endl;
+
+        PermutationT permutation;
+
+        if (options.first)
+            dictionary.partial_sort(store, permutation, options.first);
+        else if (options.unique)
+            dictionary.sort_unique(store, permutation);
+        else
+            dictionary.sort(store, permutation);
+
+        Benchmark::WallTime store_time;
+
+        written = write_lines(output, store, permutation);
+
+        std::cerr << "Stored " << permutation.size() << " words in " << store_time.total() << "s" << std::endl;
+    }
+
+    if (output != STDOUT_FILENO && close(output) == -1)
+        written = false;
+
+    if (!written) {
+        std::cerr << "Could not write output: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+int main (int argc, const char * argv[])
+{
+    Options options = {DEFAULT_ALPHABET, "", "", "", std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp", 0, 0, false};
+    bool utf8 = false;
+
+    for (int i = 1; i < argc; i += 1) {
+        std::string argument = argv[i];
+
+        if (argument == "--alphabet" && i+1 < argc) {
+            options.alphabet = argv[++i];
+        } else if (argument == "--alphabet-file" && i+1 < argc) {
+            if (!read_file(argv[++i], options.alphabet)) {
+                std::cerr << "Could not read alphabet from " << argv[i] << ": " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+
+            // The alphabet file may contain one letter per line.
+            options.alphabet.erase(std::remove(options.alphabet.begin(), options.alphabet.end(), '\n'), options.alphabet.end());
+            options.alphabet.erase(std::remove(options.alphabet.begin(), options.alphabet.end(), '\r'), options.alphabet.end());
+        } else if (argument == "--utf8") {
+            utf8 = true;
+        } else if (argument == "--output" && i+1 < argc) {
+            options.output_path = argv[++i];
+        } else if (argument == "--profile" && i+1 < argc) {
+            options.profile_path = argv[++i];
+        } else if (argument == "--memory" && i+1 < argc) {
+            options.memory_budget = parse_size(argv[++i]);
+
+            if (options.memory_budget == 0) {
+                options.input_path.clear();
+                break;
+            }
+        } else if (argument == "--first" && i+1 < argc) {
+            options.first = parse_size(argv[++i]);
+
+            if (options.first == 0) {
+                options.input_path.clear();
+                break;
+            }
+        } else if (argument == "--unique") {
+            options.unique = true;
+        } else if (argument == "--temporary" && i+1 < argc) {
+            options.temporary_directory = argv[++i];
+        } else if (options.input_path.empty() && argument.size() > 0 && argument[0] != '-') {
+            options.input_path = argument;
+        } else {
+            options.input_path.clear();
+            break;
+        }
+    }
+
+    if (options.input_path.empty() || options.alphabet.empty() || (options.first && options.memory_budget) || (options.unique && (options.first || options.memory_budget))) {
+        std::cerr << "Usage: " << argv[0] << " [--alphabet letters | --alphabet-file path] [--utf8] [--profile path] [--output path] [--first n | --unique | --memory bytes [--temporary directory]] input" << std::endl;
+        std::cerr << "Sorts the lines of the input file in the order given by the alphabet, which defaults to " << DEFAULT_ALPHABET << std::endl;
+        std::cerr << "With --utf8, the alphabet and the input are UTF-8, rather than one byte per letter." << std::endl;
+        std::cerr << "With --memory, e.g. 512M or 4G, the input is sorted in runs which fit in the given memory, which are merged using temporary files." << std::endl;
+        std::cerr << "With --first, e.g. 100 or 10K, only the first n words in sorted order are written." << std::endl;
+        std::cerr << "With --unique, each distinct word is only written once." << std::endl;
+        return 1;
+    }
+
+    if (utf8) {
+        if (!valid_utf8(options.alphabet)) {
+            std::cerr << "The alphabet is not valid UTF-8!" << std::endl;
+            return 1;
+        }
+
+        return sort_file<DictionarySort::UTF8Table>(options);
+    }
+
+    return sort_file<DictionarySort::IndexT[256]>(options);
+}
@@ -0,0 +1,155 @@
+//
+//  Sorter.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_Sorter_h
+#define DictionarySort_Sorter_h
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "ParallelMergeSort.h"
+#include "RadixSort.h"
+#include "SortByKey.h"
+#include "UniqueSort.h"
+
+namespace ParallelMergeSort {
+    /** Reusable Sorter.
+
+        Each call to sort allocates a scratch buffer as large as the input, which is page faulted in on first use and released again afterwards. When the same shape of sort repeats many times, this allocation can cost as much as a sequential sort of the same size.
+
+        A sorter keeps its scratch buffer between calls, along with the scheduler which executes the tasks, so that in the steady state a sort performs no allocation at all. The buffer grows to the largest input seen, up to maximum_count items. Larger inputs still sort correctly, using a temporary buffer which is released afterwards. Every SHRINK_INTERVAL sorts, if none of them needed more than half of the buffer, it is shrunk to the largest of them, so that one unusually large input doesn't hold on to memory forever.
+
+        A sorter is not thread safe: use one sorter per thread which sorts, but they can share the same scheduler.
+
+     */
+    template <typename ValueT>
+    class Sorter {
+    public:
+        static const std::size_t SHRINK_INTERVAL = 16;
+
+        explicit Sorter(Scheduler & scheduler = Scheduler::shared(), std::size_t maximum_count = std::numeric_limits<std::size_t>::max())
+            : _scheduler(scheduler), _maximum_count(maximum_count), _sort_count(0), _largest_count(0)
+        {
+        }
+
+        Scheduler & scheduler() const { return _scheduler; }
+
+        // The number of items which can be sorted without allocating.
+        std::size_t capacity() const { return _scratch.size(); }
+
+        std::size_t maximum_count() const { return _maximum_count; }
+
+        // Release the scratch buffer.
+        void clear() {
+            std::vector<ValueT>().swap(_scratch);
+        }
+
+        template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT>
+        void sort(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration) {
+            std::size_t count = end - begin;
+
+            if (count > _maximum_count) {
+                ParallelMergeSort::sort<PolicyT>(begin, end, comparator, configuration, _scheduler);
+            } else {
+                ParallelMergeSort::sort<PolicyT>(begin, end, comparator, configuration, _scheduler, reserve(count));
+            }
+        }
+
+        template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT>
+        void sort_adaptive(IteratorT begin, IteratorT end, const ComparatorT & comparator, const Configuration & configuration) {
+            std::size_t count = end - begin;
+
+            if (count > _maximum_count) {
+                ParallelMergeSort::sort_adaptive<PolicyT>(begin, end, comparator, configuration, _scheduler);
+            } else {
+                ParallelMergeSort::sort_adaptive<PolicyT>(begin, end, comparator, configuration, _scheduler, reserve(count));
+            }
+        }
+
+        template <typename IteratorT, typename KeyT, typename ComparatorT>
+        void radix_sort(IteratorT begin, IteratorT end, const KeyT & key, const ComparatorT & comparator) {
+            std::size_t count = end - begin;
+
+            if (count > _maximum_count) {
+                ParallelMergeSort::radix_sort(begin, end, key, comparator, _scheduler);
+            } else {
+                ParallelMergeSort::radix_sort(begin, end, key, comparator, _scheduler, reserve(count));
+            }
+        }
+
+        // Returns the end of the distinct items, see ParallelMergeSort::sort_unique.
+        template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT, typename CombineT>
+        IteratorT sort_unique(IteratorT begin, IteratorT end, const ComparatorT & comparator, const CombineT & combine, const Configuration & configuration) {
+            std::size_t count = end - begin;
+
+            if (count > _maximum_count) {
+                return ParallelMergeSort::sort_unique<PolicyT>(begin, end, comparator, combine, configuration, _scheduler);
+            } else {
+                return ParallelMergeSort::sort_unique<PolicyT>(begin, end, comparator, combine, configuration, _scheduler, reserve(count));
+            }
+        }
+
+        // As above, for keys [begin, end] with the same number of values starting at values, which are merged alongside them, e.g. counts which are added up with AddValues. The caller provides the scratch buffer for the values. Returns the end of the distinct keys.
+        template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ValueIteratorT, typename ComparatorT, typename CombineT, typename ValueScratchT>
+        IteratorT sort_unique_by_key(IteratorT begin, IteratorT end, ValueIteratorT values, const ComparatorT & comparator, const CombineT & combine, const Configuration & configuration, ValueScratchT value_scratch) {
+            std::size_t count = end - begin;
+
+            KeyValueIterator<IteratorT, ValueIteratorT> items = key_value_iterator(begin, values);
+            CompareKeys<ComparatorT> compare_keys = {comparator};
+
+            if (count > _maximum_count) {
+                std::vector<ValueT> scratch(count);
+
+                return begin + (ParallelMergeSort::sort_unique<PolicyT>(items, items + count, compare_keys, combine, configuration, _scheduler, key_value_iterator(scratch.begin(), value_scratch)) - items);
+            } else {
+                return begin + (ParallelMergeSort::sort_unique<PolicyT>(items, items + count, compare_keys, combine, configuration, _scheduler, key_value_iterator(reserve(count), value_scratch)) - items);
+            }
+        }
+
+        template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+        void sort(ArrayT & array, const ComparatorT & comparator, const Configuration & configuration) {
+            sort<PolicyT>(array.begin(), array.end(), comparator, configuration);
+        }
+
+        template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT>
+        void sort_adaptive(ArrayT & array, const ComparatorT & comparator, const Configuration & configuration) {
+            sort_adaptive<PolicyT>(array.begin(), array.end(), comparator, configuration);
+        }
+
+    protected:
+        Scheduler & _scheduler;
+        std::vector<ValueT> _scratch;
+
+        std::size_t _maximum_count;
+
+        // The number of sorts and the largest count since the buffer was last considered for shrinking.
+        std::size_t _sort_count, _largest_count;
+
+        // Returns a scratch buffer of at least count items.
+        typename std::vector<ValueT>::iterator reserve(std::size_t count) {
+            _largest_count = std::max(_largest_count, count);
+            _sort_count += 1;
+
+            if (_sort_count == SHRINK_INTERVAL) {
+                if (_largest_count < _scratch.size() / 2)
+                    std::vector<ValueT>(_largest_count).swap(_scratch);
+
+                _sort_count = 0;
+                _largest_count = 0;
+            }
+
+            if (count > _scratch.size()) {
+                // Release the old buffer first, so that both don't exist at the same time.
+                clear();
+                _scratch.resize(count);
+            }
+
+            return _scratch.begin();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,258 @@
+//
+//  Trace.cpp
+//  DictionarySort
+//
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+namespace ParallelMergeSort {
+    namespace Trace {
+        static const std::size_t PHASE_COUNT = JOIN + 1;
+
+        struct Buffer {
+            std::size_t thread;
+            std::vector<Event> events;
+        };
+
+        // Every buffer which has been registered. They are never freed, so that the events of threads which have exited can still be collected.
+        static std::mutex & registry_lock() {
+            static std::mutex lock;
+            return lock;
+        }
+
+        static std::vector<Buffer*> & registry() {
+            static std::vector<Buffer*> buffers;
+            return buffers;
+        }
+
+        static thread_local Buffer * current = 0;
+
+        static Buffer * buffer() {
+            if (!current) {
+                std::lock_guard<std::mutex> guard(registry_lock());
+
+                current = new Buffer();
+                current->thread = registry().size();
+                registry().push_back(current);
+            }
+
+            return current;
+        }
+
+        const char * name(Phase phase) {
+            switch (phase) {
+                case SORT: return "sort";
+                case NODE: return "node";
+                case PARTITION: return "partition";
+                case MERGE: return "merge";
+                case JOIN: return "join";
+            }
+
+            return "unknown";
+        }
+
+        void record(Event & event) {
+            Buffer * current = buffer();
+
+            event.thread = current->thread;
+            current->events.push_back(event);
+        }
+
+        static bool earlier(const Event & a, const Event & b) {
+            if (a.begin != b.begin)
+                return a.begin < b.begin;
+
+            // An event which contains another begins at the same time but ends later.
+            return a.end > b.end;
+        }
+
+        std::vector<Event> collect() {
+            std::lock_guard<std::mutex> guard(registry_lock());
+            std::vector<Event> events;
+
+            for (std::size_t i = 0; i < registry().size(); i += 1)
+                events.insert(events.end(), registry()[i]->events.begin(), registry()[i]->events.end());
+
+            std::sort(events.begin(), events.end(), earlier);
+
+            return events;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> guard(registry_lock());
+
+            for (std::size_t i = 0; i < registry().size(); i += 1)
+                registry()[i]->events.clear();
+        }
+
+        static double microseconds(std::uint64_t nanoseconds) {
+            return nanoseconds / 1000.0;
+        }
+
+        static double seconds(std::uint64_t nanoseconds) {
+            return nanoseconds / 1000000000.0;
+        }
+
+        void write_chrome_trace(std::ostream & output, const std::vector<Event> & events) {
+            std::uint64_t origin = events.empty() ? 0 : events.front().begin;
+            std::size_t threads = 0;
+
+            output << std::fixed << std::setprecision(3);
+            output << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+
+            for (std::size_t i = 0; i < events.size(); i += 1) {
+                const Event & event = events[i];
+
+                output << (i ? "," : "") << std::endl;
+                output << "  {\"name\": \"" << name(event.phase) << "\", \"cat\": \"sort\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << event.thread;
+                output << ", \"ts\": " << microseconds(event.begin - origin) << ", \"dur\": " << microseconds(event.end - event.begin);
+                output << ", \"args\": {\"lower_bound\": " << event.lower_bound << ", \"upper_bound\": " << event.upper_bound << ", \"count\": " << event.upper_bound - event.lower_bound << ", \"threaded\": " << event.threaded << "}}";
+
+                threads = std::max(threads, event.thread + 1);
+            }
+
+            for (std::size_t thread = 0; thread < threads; thread += 1) {
+                output << "," << std::endl << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << thread << ", \"args\": {\"name\": \"Thread " << thread << "\"}}";
+            }
+
+            output << std::endl << "]}" << std::endl;
+        }
+
+        static bool within(const Event & event, const Event & outer) {
+            return event.begin >= outer.begin && event.end <= outer.end;
+        }
+
+        // Find the event of the given phase and range which ran within outer, and on the given thread if it is not -1.
+        static const Event * find(const std::vector<Event> & events, const Event & outer, Phase phase, std::size_t lower_bound, std::size_t upper_bound, std::size_t thread = std::size_t(-1)) {
+            for (std::size_t i = 0; i < events.size(); i += 1) {
+                const Event & event = events[i];
+
+                if (event.phase == phase && event.lower_bound == lower_bound && event.upper_bound == upper_bound && within(event, outer) && (thread == std::size_t(-1) || event.thread == thread))
+                    return &event;
+            }
+
+            return 0;
+        }
+
+        static void write_range(std::ostream & output, const Event & event) {
+            std::ostringstream range;
+            range << "[" << event.lower_bound << ", " << event.upper_bound << "]";
+
+            output << std::left << std::setw(24) << range.str() << std::right;
+        }
+
+        void write_summary(std::ostream & output, const std::vector<Event> & events) {
+            // The root is the largest node of the last sort:
+            const Event * root = 0;
+
+            for (std::size_t i = 0; i < events.size(); i += 1) {
+                const Event & event = events[i];
+
+                if (event.phase == NODE && (!root || event.upper_bound - event.lower_bound >= root->upper_bound - root->lower_bound))
+                    root = &event;
+            }
+
+            if (!root) {
+                output << "No parallel partitions were traced." << std::endl;
+                return;
+            }
+
+            std::vector<Event> sort;
+
+            for (std::size_t i = 0; i < events.size(); i += 1)
+                if (within(events[i], *root))
+                    sort.push_back(events[i]);
+
+            std::uint64_t total = root->end - root->begin;
+            std::size_t threads = 0;
+
+            for (std::size_t i = 0; i < sort.size(); i += 1)
+                threads = std::max(threads, sort[i].thread + 1);
+
+            // The time spent in each phase excluding any nested phases, e.g. a join which runs another task only counts the time it was waiting.
+            std::vector<std::uint64_t> exclusive(threads * PHASE_COUNT, 0), busy(threads, 0);
+
+            for (std::size_t thread = 0; thread < threads; thread += 1) {
+                std::vector<const Event *> stack;
+
+                for (std::size_t i = 0; i < sort.size(); i += 1) {
+                    const Event & event = sort[i];
+
+                    if (event.thread != thread)
+                        continue;
+
+                    while (!stack.empty() && stack.back()->end <= event.begin)
+                        stack.pop_back();
+
+                    std::uint64_t duration = event.end - event.begin;
+                    exclusive[thread * PHASE_COUNT + event.phase] += duration;
+
+                    if (stack.empty())
+                        busy[thread] += duration;
+                    else
+                        exclusive[thread * PHASE_COUNT + stack.back()->phase] -= duration;
+
+                    stack.push_back(&event);
+                }
+            }
+
+            output << std::fixed << std::setprecision(6);
+            output << "Sort of [" << root->lower_bound << ", " << root->upper_bound << "] with threaded = " << root->threaded << " took " << seconds(total) << "s on " << threads << " threads." << std::endl;
+
+            output << "Thread   Partition       Merge        Join       Other        Idle" << std::endl;
+
+            for (std::size_t thread = 0; thread < threads; thread += 1) {
+                const std::uint64_t * phases = &exclusive[thread * PHASE_COUNT];
+
+                output << std::setw(6) << thread;
+                output << std::setw(12) << seconds(phases[PARTITION]) << std::setw(12) << seconds(phases[MERGE]) << std::setw(12) << seconds(phases[JOIN]);
+                output << std::setw(12) << seconds(phases[SORT] + phases[NODE]) << std::setw(12) << seconds(total - std::min(total, busy[thread])) << std::endl;
+            }
+
+            // Follow the child which finished last from the root to a leaf. The node can't merge until then, so this is the path which determines the time of the whole sort.
+            std::uint64_t start_total = 0, join_total = 0, merge_total = 0, partition_total = 0;
+
+            output << "Critical path:" << std::endl;
+            output << "Depth  Range                   Thread       Start   Partition   Join Wait       Merge" << std::endl;
+
+            const Event * node = root, * parent = 0;
+
+            for (std::size_t depth = 0; node; depth += 1) {
+                std::size_t middle_bound = (node->lower_bound + node->upper_bound) / 2;
+
+                const Event * lower = find(sort, *node, NODE, node->lower_bound, middle_bound);
+                const Event * upper = find(sort, *node, NODE, middle_bound, node->upper_bound);
+                const Event * child = lower && upper ? (upper->end > lower->end ? upper : lower) : (lower ? lower : upper);
+
+                const Event * partition = find(sort, *node, PARTITION, node->lower_bound, node->upper_bound, node->thread);
+                const Event * merge = find(sort, *node, MERGE, node->lower_bound, node->upper_bound, node->thread);
+
+                // The time from the parent starting to this node starting, e.g. how long a forked task waited for a worker.
+                std::uint64_t start = parent ? node->begin - parent->begin : 0;
+                std::uint64_t partition_time = partition ? partition->end - partition->begin : 0;
+                std::uint64_t merge_time = merge ? merge->end - merge->begin : 0;
+
+                // The time from the slower child finishing to the merge starting, e.g. how long the join took to notice, or another task it was running.
+                std::uint64_t ready = child ? child->end : (partition ? partition->end : node->begin);
+                std::uint64_t join_time = (merge ? merge->begin : node->end) - std::min(ready, merge ? merge->begin : node->end);
+
+                output << std::setw(5) << depth << "  ";
+                write_range(output, *node);
+                output << std::setw(6) << node->thread << std::setw(12) << seconds(start) << std::setw(12) << seconds(partition_time) << std::setw(12) << seconds(join_time) << std::setw(12) << seconds(merge_time) << std::endl;
+
+                start_total += start, partition_total += partition_time, join_total += join_time, merge_total += merge_time;
+
+                parent = node;
+                node = child;
+            }
+
+            output << "Critical path total: start " << seconds(start_total) << "s, partition " << seconds(partition_total) << "s, join wait " << seconds(join_total) << "s, merge " << seconds(merge_total) << "s";
+            output << ", other " << seconds(total - std::min(total, start_total + partition_total + join_total + merge_total)) << "s." << std::endl;
+        }
+    }
+}
@@ -0,0 +1,110 @@
+//
+//  Trace.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_Trace_h
+#define DictionarySort_Trace_h
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Tracing is compiled out unless this is defined to 1, e.g. with -DPARALLEL_MERGE_SORT_TRACE=1.
+#ifndef PARALLEL_MERGE_SORT_TRACE
+#define PARALLEL_MERGE_SORT_TRACE 0
+#endif
+
+namespace ParallelMergeSort {
+    /** Partition Tree Trace.
+
+        Records when each node of the partition tree runs, and on which thread, so that we can see where a parallel sort spends its time: a node which starts late because no worker was free, a join which waits on a slow sibling, or a merge at the top of the tree which doesn't split into enough segments.
+
+        Each thread appends events to its own buffer, so recording an event never takes a lock or shares a cache line with another thread. Buffers are registered once per thread and kept for the life of the process, so that events recorded by a worker can still be collected after it exits.
+
+        The tree is traced down to the partitions which are sorted sequentially, so a sort has at most a few events per task, and the cost is a clock read at the start and end of each phase. With PARALLEL_MERGE_SORT_TRACE 0, Scope is empty and every probe compiles away.
+
+        The events can be written as a Chrome trace, which can be opened in Perfetto or chrome://tracing, along with a summary of the critical path through the tree:
+
+            Trace::clear();
+            ParallelMergeSort::sort(array, comparator, 3);
+
+            std::vector<Trace::Event> events = Trace::collect();
+            Trace::write_chrome_trace(output, events);
+            Trace::write_summary(std::cerr, events);
+
+     */
+    namespace Trace {
+        const bool ENABLED = PARALLEL_MERGE_SORT_TRACE;
+
+        enum Phase {
+            // A whole call to sort.
+            SORT,
+            // A node of the parallel partition tree, including its children and its merge.
+            NODE,
+            // Sorting both halves of a node sequentially.
+            PARTITION,
+            // Merging a node, or one segment of a parallel merge.
+            MERGE,
+            // Waiting for a forked task, which includes running any other tasks in the mean time.
+            JOIN
+        };
+
+        const char * name(Phase phase);
+
+        struct Event {
+            Phase phase;
+            std::size_t lower_bound, upper_bound, threaded;
+
+            // Nanoseconds since an arbitrary epoch, the same for every thread.
+            std::uint64_t begin, end;
+
+            // The order in which the recording thread first recorded an event, starting from 0.
+            std::size_t thread;
+        };
+
+        inline std::uint64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Append the event to the buffer of the calling thread.
+        void record(Event & event);
+
+        // The events recorded by every thread, ordered by when they began. No sort may be running at the same time.
+        std::vector<Event> collect();
+
+        // Discard all recorded events. No sort may be running at the same time.
+        void clear();
+
+        // Write the events in the Chrome trace event format, with times relative to the first event.
+        void write_chrome_trace(std::ostream & output, const std::vector<Event> & events);
+
+        // Write the time spent in each phase by each thread, and the critical path from the root of the last traced sort down to the leaf which finished last.
+        void write_summary(std::ostream & output, const std::vector<Event> & events);
+
+        // Records the time from construction to destruction as an event.
+        class Scope {
+        public:
+#if PARALLEL_MERGE_SORT_TRACE
+            Scope(Phase phase, std::size_t lower_bound, std::size_t upper_bound, std::size_t threaded) {
+                Event event = {phase, lower_bound, upper_bound, threaded, now(), 0, 0};
+                _event = event;
+            }
+
+            ~Scope() {
+                _event.end = now();
+                record(_event);
+            }
+
+        private:
+            Event _event;
+#else
+            Scope(Phase, std::size_t, std::size_t, std::size_t) {}
+#endif
+        };
+    }
+}
+
+#endif
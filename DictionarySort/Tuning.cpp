@@ -0,0 +1,189 @@
+//
+//  Tuning.cpp
+//  DictionarySort
+//
+
+#include "Tuning.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace ParallelMergeSort {
+    // Profiles contain a configuration for every power of 4 from 2^8 up to 2^32 items.
+    static const std::size_t PROFILE_MINIMUM_COUNT = 256;
+    static const std::size_t PROFILE_SIZE_COUNT = 13;
+
+    // The deepest tree considered by the cost model, relative to log2(concurrency).
+    static const std::size_t PROFILE_EXTRA_DEPTH = 3;
+
+    static Benchmark::TimeT binary_logarithm (Benchmark::TimeT value) {
+        return value > 2 ? std::log(value) / std::log(2.0) : 1;
+    }
+
+    static bool compare_entries (const Profile::Entry & a, const Profile::Entry & b) {
+        return a.count < b.count;
+    }
+
+    Profile::Profile ()
+        : _concurrency(0), _element_size(0), _comparison_time(0), _move_time(0), _task_time(0)
+    {
+    }
+
+    Profile Profile::estimate (std::size_t concurrency, std::size_t element_size, Benchmark::TimeT comparison_time, Benchmark::TimeT move_time, Benchmark::TimeT task_time)
+    {
+        Profile profile;
+
+        profile._concurrency = std::max<std::size_t>(concurrency, 1);
+        profile._element_size = element_size;
+        profile._comparison_time = comparison_time;
+        profile._move_time = move_time;
+        profile._task_time = task_time;
+
+        // The cost of processing one item at one level of the tree.
+        const Benchmark::TimeT item_time = std::max(comparison_time + move_time, std::numeric_limits<Benchmark::TimeT>::min());
+        const Benchmark::TimeT task_work = task_time * TASK_WORK_RATIO;
+        const Benchmark::TimeT workers = Benchmark::TimeT(profile._concurrency);
+
+        // A merge segment does item_time of work per item.
+        std::size_t merge_minimum_count = std::max<std::size_t>(1, std::size_t(std::ceil(task_work / item_time)));
+
+        // A partition does item_time * log2(count) of work per item.
+        std::size_t partition_minimum_count = 2;
+        while (partition_minimum_count < std::numeric_limits<std::size_t>::max() / 2 && item_time * partition_minimum_count * binary_logarithm(partition_minimum_count) < task_work)
+            partition_minimum_count *= 2;
+
+        std::size_t maximum_depth = std::size_t(std::ceil(binary_logarithm(workers))) + PROFILE_EXTRA_DEPTH;
+
+        std::size_t count = PROFILE_MINIMUM_COUNT;
+
+        for (std::size_t size = 0; size < PROFILE_SIZE_COUNT; size += 1, count *= 4) {
+            const Benchmark::TimeT n = Benchmark::TimeT(count);
+
+            std::size_t best_depth = 0;
+            Benchmark::TimeT best_time = item_time * n * binary_logarithm(n);
+
+            for (std::size_t depth = 1; depth <= maximum_depth && (count >> depth) > partition_minimum_count; depth += 1) {
+                const Benchmark::TimeT partitions = Benchmark::TimeT(std::size_t(1) << depth);
+                const Benchmark::TimeT leaf = n / partitions;
+
+                // The leaves are sorted sequentially, p at a time.
+                Benchmark::TimeT time = item_time * leaf * binary_logarithm(leaf) * std::ceil(partitions / workers);
+
+                // Every level of merges processes all n items, but the top levels have fewer merges to go around, and rely on splitting each merge into segments.
+                for (std::size_t level = 0; level < depth; level += 1) {
+                    std::size_t merge_count = count >> level;
+                    Benchmark::TimeT segments = merge_count > merge_minimum_count ? std::min(workers, Benchmark::TimeT(merge_count / merge_minimum_count)) : 1;
+                    Benchmark::TimeT parallelism = std::min(workers, Benchmark::TimeT(std::size_t(1) << level) * segments);
+
+                    time += item_time * n / parallelism + task_time * std::ceil(binary_logarithm(segments));
+                }
+
+                // The critical path forks once per level.
+                time += task_time * depth;
+
+                if (time < best_time) {
+                    best_time = time;
+                    best_depth = depth;
+                }
+            }
+
+            // The smallest configuration applies to everything below it too.
+            Entry entry = {profile._entries.empty() ? 0 : count, Configuration(best_depth, partition_minimum_count, merge_minimum_count)};
+            profile._entries.push_back(entry);
+
+            // Don't overflow on 32-bit platforms.
+            if (count > std::numeric_limits<std::size_t>::max() / 4)
+                break;
+        }
+
+        return profile;
+    }
+
+    Configuration Profile::configuration (std::size_t count, const Configuration & fallback) const
+    {
+        Configuration result = fallback;
+
+        for (std::vector<Entry>::const_iterator i = _entries.begin(); i != _entries.end() && i->count <= count; ++i) {
+            result = i->configuration;
+        }
+
+        return result;
+    }
+
+    bool Profile::save (const std::string & path) const
+    {
+        std::ofstream output(path.c_str());
+
+        output.precision(6);
+
+        output << "# ParallelMergeSort profile" << std::endl;
+        output << "concurrency " << _concurrency << std::endl;
+        output << "element_size " << _element_size << std::endl;
+        output << "comparison_time " << _comparison_time << std::endl;
+        output << "move_time " << _move_time << std::endl;
+        output << "task_time " << _task_time << std::endl;
+
+        for (std::vector<Entry>::const_iterator i = _entries.begin(); i != _entries.end(); ++i) {
+            output << "configuration " << i->count << " " << i->configuration.threaded << " " << i->configuration.parallel_partition_minimum_count << " " << i->configuration.parallel_merge_minimum_count << std::endl;
+        }
+
+        return bool(output);
+    }
+
+    bool Profile::load (const std::string & path)
+    {
+        std::ifstream input(path.c_str());
+
+        if (!input)
+            return false;
+
+        Profile profile;
+        std::string line;
+
+        while (std::getline(input, line)) {
+            std::istringstream fields(line);
+            std::string key;
+
+            if (!(fields >> key) || key[0] == '#')
+                continue;
+
+            if (key == "concurrency") {
+                fields >> profile._concurrency;
+            } else if (key == "element_size") {
+                fields >> profile._element_size;
+            } else if (key == "comparison_time") {
+                fields >> profile._comparison_time;
+            } else if (key == "move_time") {
+                fields >> profile._move_time;
+            } else if (key == "task_time") {
+                fields >> profile._task_time;
+            } else if (key == "configuration") {
+                Entry entry = {0, Configuration(0, 0, 0)};
+                fields >> entry.count >> entry.configuration.threaded >> entry.configuration.parallel_partition_minimum_count >> entry.configuration.parallel_merge_minimum_count;
+
+                // A merge cutoff of zero would split merges into an unlimited number of segments.
+                if (entry.configuration.parallel_merge_minimum_count == 0)
+                    return false;
+
+                profile._entries.push_back(entry);
+            } else {
+                return false;
+            }
+
+            if (fields.fail())
+                return false;
+        }
+
+        if (profile._entries.empty())
+            return false;
+
+        std::stable_sort(profile._entries.begin(), profile._entries.end(), compare_entries);
+
+        *this = profile;
+
+        return true;
+    }
+}
@@ -0,0 +1,102 @@
+//
+//  Tuning.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_Tuning_h
+#define DictionarySort_Tuning_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "Benchmark.h"
+
+namespace ParallelMergeSort {
+    // The parameters which control how a single sort is distributed over the scheduler.
+    struct Configuration {
+        // The number of levels of the partition tree which are executed as tasks, e.g. at most 2^threaded partitions.
+        std::size_t threaded;
+
+        // Partitions with this many items or fewer are sorted sequentially rather than forked (the grain size).
+        std::size_t parallel_partition_minimum_count;
+
+        // Merges with this many items or fewer are performed sequentially, and larger merges are split into segments of at least this size.
+        std::size_t parallel_merge_minimum_count;
+
+        Configuration(std::size_t _threaded, std::size_t _parallel_partition_minimum_count, std::size_t _parallel_merge_minimum_count)
+            : threaded(_threaded), parallel_partition_minimum_count(_parallel_partition_minimum_count), parallel_merge_minimum_count(_parallel_merge_minimum_count)
+        {
+        }
+    };
+
+    /** Tuning Profile.
+
+        A profile describes the host it was calibrated on (the number of workers, and the measured cost of comparing and moving one element) and the configuration to use for each input size. Configurations are chosen using a simple cost model:
+
+            sort(n, d) = leaves + merges + forks
+            leaves = c * (n/2^d) * log2(n/2^d) * ceil(2^d / p)
+            merges = sum over each level l < d of c * n / min(p, 2^l * segments(n/2^l))
+            forks = t * (d + levels of segment splitting)
+
+        where c is the cost of comparing and moving one item, t is the cost of forking and joining one task and p is the number of workers. For each size, the depth d with the lowest estimated time is chosen. The grain size and merge cutoff are chosen so that every task does at least TASK_WORK_RATIO times more work than it costs to fork it.
+
+        Profiles can be saved to and loaded from a simple text file, so that a process can load a calibration which was measured once per machine shape:
+
+            # ParallelMergeSort profile
+            concurrency 8
+            element_size 8
+            comparison_time 2.1e-08
+            move_time 1.2e-09
+            task_time 4.5e-06
+            configuration 1024 0 1024 4096
+            configuration 4096 1 1024 4096
+            ...
+
+        Each configuration line gives the minimum input size it applies to, followed by threaded, parallel_partition_minimum_count and parallel_merge_minimum_count.
+
+     */
+    class Profile {
+    public:
+        struct Entry {
+            std::size_t count;
+            Configuration configuration;
+        };
+
+        // Every task should do at least this many times more work than it costs to fork and join it.
+        static const std::size_t TASK_WORK_RATIO = 16;
+
+        Profile();
+
+        // Build a profile for the given measurements using the cost model described above.
+        static Profile estimate(std::size_t concurrency, std::size_t element_size, Benchmark::TimeT comparison_time, Benchmark::TimeT move_time, Benchmark::TimeT task_time);
+
+        // The configuration for sorting count items. If the profile is empty, the fallback is returned.
+        Configuration configuration(std::size_t count, const Configuration & fallback) const;
+
+        bool empty() const { return _entries.empty(); }
+
+        const std::vector<Entry> & entries() const { return _entries; }
+
+        std::size_t concurrency() const { return _concurrency; }
+        std::size_t element_size() const { return _element_size; }
+        Benchmark::TimeT comparison_time() const { return _comparison_time; }
+        Benchmark::TimeT move_time() const { return _move_time; }
+        Benchmark::TimeT task_time() const { return _task_time; }
+
+        // Returns false if the file could not be written.
+        bool save(const std::string & path) const;
+
+        // Returns false if the file could not be read or was not a valid profile, in which case the profile is left unchanged.
+        bool load(const std::string & path);
+
+    protected:
+        std::size_t _concurrency, _element_size;
+        Benchmark::TimeT _comparison_time, _move_time, _task_time;
+
+        // Sorted by ascending count.
+        std::vector<Entry> _entries;
+    };
+}
+
+#endif
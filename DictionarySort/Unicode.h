@@ -0,0 +1,120 @@
+//
+//  Unicode.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_Unicode_h
+#define DictionarySort_Unicode_h
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace DictionarySort {
+    typedef std::uint32_t CodepointT;
+
+    // One past the largest Unicode codepoint, U+10FFFF.
+    const CodepointT CODEPOINT_LIMIT = 0x110000;
+
+    // Returned for bytes which are not part of a valid UTF-8 sequence. It is beyond the last codepoint, so it never has an order.
+    const CodepointT INVALID_CODEPOINT = 0xFFFFFFFF;
+
+    // Decode the UTF-8 sequence at begin, and advance past it. An invalid, overlong or truncated sequence decodes its first byte as INVALID_CODEPOINT, and decoding continues from the next byte.
+    inline CodepointT decode_utf8(const char *& begin, const char * end)
+    {
+        std::uint8_t lead = *begin++;
+
+        if (lead < 0x80)
+            return lead;
+
+        std::size_t length;
+        CodepointT codepoint, minimum;
+
+        if ((lead & 0xE0) == 0xC0) {
+            length = 1, codepoint = lead & 0x1F, minimum = 0x80;
+        } else if ((lead & 0xF0) == 0xE0) {
+            length = 2, codepoint = lead & 0x0F, minimum = 0x800;
+        } else if ((lead & 0xF8) == 0xF0) {
+            length = 3, codepoint = lead & 0x07, minimum = 0x10000;
+        } else {
+            return INVALID_CODEPOINT;
+        }
+
+        if (std::size_t(end - begin) < length)
+            return INVALID_CODEPOINT;
+
+        for (std::size_t i = 0; i < length; i += 1) {
+            std::uint8_t next = begin[i];
+
+            if ((next & 0xC0) != 0x80)
+                return INVALID_CODEPOINT;
+
+            codepoint = (codepoint << 6) | (next & 0x3F);
+        }
+
+        // Surrogates are only valid in UTF-16.
+        if (codepoint < minimum || codepoint >= CODEPOINT_LIMIT || (codepoint >= 0xD800 && codepoint < 0xE000))
+            return INVALID_CODEPOINT;
+
+        begin += length;
+
+        return codepoint;
+    }
+
+    /** Codepoint Table.
+
+        Maps Unicode codepoints to their order in the alphabet, for e.g. Dictionary<std::uint32_t, CodepointTable>. Looking up a character in a std::map costs a tree search, which dominates generating the order of every word for large alphabets, e.g. CJK. This table is a two level page table instead: the codepoint's high bits index a page, and the low bits index the order within the page. Only pages which contain a letter are allocated, and every other page refers to a shared page of zeros, so a lookup is always two loads without any branches other than the range check.
+
+        A 26 letter alphabet uses one page, and an alphabet of 20,000 CJK ideographs uses about 80 pages, i.e. 80KB. Like the other maps, it is only read once it has been built, so lookups are safe from multiple threads.
+
+     */
+    class CodepointTable {
+    public:
+        static const std::size_t PAGE_BITS = 8;
+        static const std::size_t PAGE_SIZE = 1 << PAGE_BITS;
+
+        CodepointTable() : _pages(CODEPOINT_LIMIT >> PAGE_BITS, 0), _orders(PAGE_SIZE, 0) {}
+
+        // Codepoints which are not in the table, including any beyond U+10FFFF, have order 0.
+        std::uint32_t find(CodepointT codepoint) const {
+            if (codepoint >= CODEPOINT_LIMIT)
+                return 0;
+
+            return _orders[(std::size_t(_pages[codepoint >> PAGE_BITS]) << PAGE_BITS) | (codepoint & (PAGE_SIZE - 1))];
+        }
+
+        // Throws std::out_of_range if the codepoint is beyond U+10FFFF, e.g. an invalid UTF-8 sequence in the alphabet.
+        void assign(CodepointT codepoint, std::uint32_t order) {
+            if (codepoint >= CODEPOINT_LIMIT)
+                throw std::out_of_range("Codepoint is not valid Unicode!");
+
+            std::uint16_t & page = _pages[codepoint >> PAGE_BITS];
+
+            // Page 0 is shared by every codepoint without an order, so this codepoint needs a page of its own.
+            if (page == 0) {
+                page = _orders.size() >> PAGE_BITS;
+                _orders.resize(_orders.size() + PAGE_SIZE, 0);
+            }
+
+            _orders[(std::size_t(page) << PAGE_BITS) | (codepoint & (PAGE_SIZE - 1))] = order;
+        }
+
+    private:
+        // The page of orders for every PAGE_SIZE codepoints. There are at most 4352 pages, so the index fits in 16 bits.
+        std::vector<std::uint16_t> _pages;
+        std::vector<std::uint32_t> _orders;
+    };
+
+    /** UTF-8 Codepoint Table.
+
+        A codepoint table for dictionaries of UTF-8 text, i.e. Dictionary<char, UTF8Table>. The alphabet and the words are given as UTF-8, and each character is decoded and translated in one pass while generating the order of a word, so the words are never converted to UCS-4 and can be sorted in place, e.g. in a WordStore referencing a mapped file.
+
+        A word has at most as many characters as it has bytes, so Dictionary::segment_count(length) is an upper bound for UTF-8 words, and Dictionary::sum returns the actual number of segments.
+
+     */
+    class UTF8Table : public CodepointTable {
+    };
+}
+
+#endif
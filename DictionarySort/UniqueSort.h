@@ -0,0 +1,326 @@
+//
+//  UniqueSort.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_UniqueSort_h
+#define DictionarySort_UniqueSort_h
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <vector>
+
+#include "ParallelMergeSort.h"
+
+namespace ParallelMergeSort {
+    /** Parallel Unique Sort.
+
+        Sorting a corpus of words, which are mostly duplicates, and then removing the duplicates in a separate pass, moves every copy of every word at every level of the tree, only to throw most of them away at the end. Instead, a unique sort removes duplicates as it goes: each node of the partition tree keeps only one item for each distinct key, at the start of its range, so every merge above it only moves the distinct items of its children. For Zipf distributed input, the upper levels of the tree and the final output touch a small fraction of the memory of a full sort.
+
+        When two items compare equal, the later one (in input order) is removed, and combine(kept, removed) is called first, e.g. to add up a count which each item carries. The items which are kept are the first of each key, so the result is the same as a stable sort followed by std::unique.
+
+        - A leaf is sorted with the policy's base case kernel, and then adjacent equal items are collapsed while it is moved into place.
+        - A node merges the distinct items of its two children. Each child is already distinct, so an item can only be equal to the head of the other child, and the two are collapsed into one. This costs a second comparison whenever the lower item is taken.
+        - Large merges are split into segments using the merge path (see ParallelMerge), and each segment is merged into its own part of the destination. The segments are then moved down next to each other, collapsing the items at each boundary which are equal, which is sequential, but only moves the distinct items.
+
+        The parity scheme is the same as partition: each child writes its items to the start of its range of the other buffer, and the node merges them into the start of its range of its own destination.
+
+     */
+    template <typename PolicyT, typename ComparatorT, typename CombineT>
+    class UniqueSort {
+    public:
+        UniqueSort(const ComparatorT & comparator, const CombineT & combine, const Configuration & configuration, Scheduler & scheduler)
+            : _comparator(comparator), _combine(combine), _configuration(configuration), _scheduler(scheduler)
+        {
+        }
+
+        // Sort [lower_bound, upper_bound] into destination, keeping one item for each distinct key at the start of the range, and return how many there are. If in_place is true, the unsorted items are in destination, otherwise they are in source. The top threaded levels of the tree are executed as tasks.
+        template <typename SourceT, typename DestinationT>
+        std::size_t sort(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t threaded);
+
+    protected:
+        const ComparatorT & _comparator;
+        const CombineT & _combine;
+        const Configuration & _configuration;
+        Scheduler & _scheduler;
+
+        template <typename SourceT, typename DestinationT>
+        struct ParallelUniqueSort {
+            UniqueSort & unique_sort;
+            SourceT source;
+            DestinationT destination;
+            std::size_t lower_bound, upper_bound;
+            bool in_place;
+            std::size_t threaded;
+
+            // The task is copied by the scheduler, so the result is written through a reference.
+            std::size_t & kept;
+
+            void operator()() {
+                kept = unique_sort.sort(source, destination, lower_bound, upper_bound, in_place, threaded);
+            }
+        };
+
+        // Collapse equal items of the sorted range [lower_bound, upper_bound] of array in place, and return how many are kept.
+        template <typename IteratorT>
+        std::size_t unique(IteratorT array, std::size_t lower_bound, std::size_t upper_bound) {
+            std::size_t last = lower_bound;
+
+            for (std::size_t offset = lower_bound + 1; offset < upper_bound; offset += 1) {
+                if (_comparator(array[last], array[offset])) {
+                    last += 1;
+
+                    if (last != offset)
+                        array[last] = std::move(array[offset]);
+                } else {
+                    _combine(array[last], array[offset]);
+                }
+            }
+
+            return last + 1 - lower_bound;
+        }
+
+        // As above, moving the items which are kept from source into destination starting at offset.
+        template <typename SourceT, typename DestinationT>
+        std::size_t unique_move(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, std::size_t offset) {
+            std::size_t first = offset;
+
+            destination[offset] = std::move(source[lower_bound]);
+
+            for (std::size_t i = lower_bound + 1; i < upper_bound; i += 1) {
+                if (_comparator(destination[offset], source[i]))
+                    destination[++offset] = std::move(source[i]);
+                else
+                    _combine(destination[offset], source[i]);
+            }
+
+            return offset + 1 - first;
+        }
+
+        // Sort a leaf with the base case kernel, and collapse its equal items.
+        template <typename SourceT, typename DestinationT>
+        std::size_t leaf(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place) {
+            typedef typename PolicyT::template BaseCaseT<ComparatorT, typename std::iterator_traits<DestinationT>::value_type> BaseCaseT;
+
+            if (upper_bound - lower_bound == 0)
+                return 0;
+
+            if (in_place) {
+                BaseCaseT::sort(destination, _comparator, lower_bound, upper_bound);
+
+                return unique(destination, lower_bound, upper_bound);
+            } else {
+                BaseCaseT::sort(source, _comparator, lower_bound, upper_bound);
+
+                return unique_move(source, destination, lower_bound, upper_bound, lower_bound);
+            }
+        }
+
+        // Sort [lower_bound, upper_bound] sequentially, as above.
+        template <typename SourceT, typename DestinationT>
+        std::size_t sort(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place) {
+            typedef typename PolicyT::template BaseCaseT<ComparatorT, typename std::iterator_traits<DestinationT>::value_type> BaseCaseT;
+
+            if (upper_bound - lower_bound <= BaseCaseT::MAXIMUM_COUNT)
+                return leaf(source, destination, lower_bound, upper_bound, in_place);
+
+            std::size_t middle_bound = (lower_bound + upper_bound) / 2;
+
+            std::size_t lower_count = sort(destination, source, lower_bound, middle_bound, !in_place);
+            std::size_t upper_count = sort(destination, source, middle_bound, upper_bound, !in_place);
+
+            return merge(source, destination, lower_bound, lower_count, middle_bound, upper_count, 0);
+        }
+
+        // Merge the distinct items [left, left_end] and [right, right_end] of source into destination starting at offset, collapsing items which are equal, and return how many were written. Ties are taken from the left first, so the left item is kept.
+        template <typename SourceT, typename DestinationT>
+        std::size_t merge_unique(SourceT source, DestinationT destination, std::size_t left, std::size_t left_end, std::size_t right, std::size_t right_end, std::size_t offset) {
+            std::size_t first = offset;
+
+            while (left < left_end && right < right_end) {
+                if (_comparator(source[right], source[left])) {
+                    destination[offset++] = std::move(source[right++]);
+                } else {
+                    if (!_comparator(source[left], source[right])) {
+                        _combine(source[left], source[right]);
+                        right += 1;
+                    }
+
+                    destination[offset++] = std::move(source[left++]);
+                }
+            }
+
+            std::move(source + left, source + left_end, destination + offset);
+            offset += left_end - left;
+
+            std::move(source + right, source + right_end, destination + offset);
+            offset += right_end - right;
+
+            return offset - first;
+        }
+
+        // One segment of a parallel merge, which writes its items to destination starting at lower_bound + begin_rank.
+        template <typename SourceT, typename DestinationT>
+        struct Segment {
+            UniqueSort & unique_sort;
+            SourceT source;
+            DestinationT destination;
+            std::size_t lower_bound, middle_bound, begin_rank, begin_split, end_rank, end_split;
+
+            // The task is copied by the scheduler, so the result is written through a reference.
+            std::size_t & kept;
+
+            void operator()() {
+                Trace::Scope merge_scope(Trace::MERGE, lower_bound + begin_rank, lower_bound + end_rank, 0);
+
+                kept = unique_sort.merge_unique(source, destination, lower_bound + begin_split, lower_bound + end_split, middle_bound + (begin_rank - begin_split), middle_bound + (end_rank - end_split), lower_bound + begin_rank);
+            }
+        };
+
+        // Merge [lower_bound, lower_bound + lower_count] and [middle_bound, middle_bound + upper_count] of source into the start of [lower_bound, ...] of destination, and return how many items were kept.
+        template <typename SourceT, typename DestinationT>
+        std::size_t merge(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t lower_count, std::size_t middle_bound, std::size_t upper_count, std::size_t threaded) {
+            std::size_t count = lower_count + upper_count;
+
+            // If every item of the lower child is less than every item of the upper child, there is nothing to merge or collapse.
+            if (lower_count == 0 || upper_count == 0 || _comparator(source[lower_bound + lower_count - 1], source[middle_bound])) {
+                std::move(source + lower_bound, source + lower_bound + lower_count, destination + lower_bound);
+                std::move(source + middle_bound, source + middle_bound + upper_count, destination + lower_bound + lower_count);
+
+                return count;
+            }
+
+            std::size_t segments = 1;
+
+            if (PolicyT::PARALLEL_MERGE && threaded > 0 && count > _configuration.parallel_merge_minimum_count)
+                segments = std::min(_scheduler.concurrency(), count / _configuration.parallel_merge_minimum_count);
+
+            if (segments <= 1)
+                return merge_unique(source, destination, lower_bound, lower_bound + lower_count, middle_bound, middle_bound + upper_count, lower_bound);
+
+            std::vector<std::size_t> kept(segments);
+
+            std::deque<Scheduler::FunctorTask<Segment<SourceT, DestinationT> > > tasks;
+            std::size_t begin_split = 0;
+
+            for (std::size_t i = 0; i < segments; i += 1) {
+                std::size_t begin_rank = count * i / segments, end_rank = count * (i+1) / segments;
+
+                // The children are not adjacent, so the co-rank is bounded by the number of items in each of them.
+                std::size_t end_split = co_rank(source, _comparator, lower_bound, middle_bound, end_rank, end_rank > upper_count ? end_rank - upper_count : 0, std::min(end_rank, lower_count));
+
+                Segment<SourceT, DestinationT> segment = {*this, source, destination, lower_bound, middle_bound, begin_rank, begin_split, end_rank, end_split, kept[i]};
+                tasks.emplace_back(segment);
+
+                begin_split = end_split;
+            }
+
+            _scheduler.fork_join(tasks);
+
+            // Move each segment down next to the one before it. Equal items may be split across a boundary, in which case the first item of the later segment is collapsed into the last item which was kept.
+            std::size_t total = kept[0];
+
+            for (std::size_t i = 1; i < segments; i += 1) {
+                std::size_t offset = lower_bound + count * i / segments, end = offset + kept[i];
+
+                if (offset < end && total > 0 && !_comparator(destination[lower_bound + total - 1], destination[offset])) {
+                    _combine(destination[lower_bound + total - 1], destination[offset]);
+                    offset += 1;
+                }
+
+                if (lower_bound + total != offset)
+                    std::move(destination + offset, destination + end, destination + lower_bound + total);
+
+                total += end - offset;
+            }
+
+            return total;
+        }
+    };
+
+    template <typename PolicyT, typename ComparatorT, typename CombineT>
+    template <typename SourceT, typename DestinationT>
+    std::size_t UniqueSort<PolicyT, ComparatorT, CombineT>::sort(SourceT source, DestinationT destination, std::size_t lower_bound, std::size_t upper_bound, bool in_place, std::size_t threaded) {
+        typedef typename PolicyT::template BaseCaseT<ComparatorT, typename std::iterator_traits<DestinationT>::value_type> BaseCaseT;
+
+        std::size_t count = upper_bound - lower_bound;
+
+        if (threaded == 0 || count <= BaseCaseT::MAXIMUM_COUNT)
+            return sort(source, destination, lower_bound, upper_bound, in_place);
+
+        Trace::Scope node_scope(Trace::NODE, lower_bound, upper_bound, threaded);
+
+        std::size_t middle_bound = (lower_bound + upper_bound) / 2;
+        std::size_t lower_count, upper_count;
+
+        if (PolicyT::PARALLEL_PARTITION && count > _configuration.parallel_partition_minimum_count) {
+            ParallelUniqueSort<DestinationT, SourceT> upper_unique_sort = {*this, destination, source, middle_bound, upper_bound, !in_place, threaded - 1, upper_count};
+            Scheduler::FunctorTask<ParallelUniqueSort<DestinationT, SourceT> > upper_task(upper_unique_sort);
+
+            _scheduler.fork(upper_task);
+            lower_count = sort(destination, source, lower_bound, middle_bound, !in_place, threaded - 1);
+
+            Trace::Scope join_scope(Trace::JOIN, lower_bound, upper_bound, threaded);
+            _scheduler.join(upper_task);
+        } else {
+            Trace::Scope partition_scope(Trace::PARTITION, lower_bound, upper_bound, threaded);
+
+            lower_count = sort(destination, source, lower_bound, middle_bound, !in_place);
+            upper_count = sort(destination, source, middle_bound, upper_bound, !in_place);
+        }
+
+        Trace::Scope merge_scope(Trace::MERGE, lower_bound, upper_bound, threaded);
+
+        return merge(source, destination, lower_bound, lower_count, middle_bound, upper_count, threaded);
+    }
+
+    // Keeps the first of each group of equal items and discards the rest.
+    struct KeepFirst {
+        template <typename KeptT, typename RemovedT>
+        void operator()(KeptT &&, RemovedT &&) const {
+        }
+    };
+
+    // Adds the value of each removed key-value item (see KeyValueIterator) to the value which is kept, e.g. to count how many times each key occurs.
+    struct AddValues {
+        template <typename KeptT, typename RemovedT>
+        void operator()(KeptT && kept, RemovedT && removed) const {
+            kept.value += removed.value;
+        }
+    };
+
+    /** Unique Sort, main entry point.
+
+        Sort [begin, end] keeping only the first of each group of equal items, which are moved to the start of the range, and return the end of them. Each item which is removed is first passed to combine(kept, removed), along with the item which is kept. The items after the returned end are moved from, and are left in an unspecified order. The caller provides a scratch buffer of at least (end - begin) items.
+
+     */
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT, typename CombineT, typename ScratchT>
+    IteratorT sort_unique(IteratorT begin, IteratorT end, const ComparatorT & comparator, const CombineT & combine, const Configuration & configuration, Scheduler & scheduler, ScratchT scratch) {
+        std::size_t count = end - begin;
+
+        Trace::Scope sort_scope(Trace::SORT, 0, count, configuration.threaded);
+
+        UniqueSort<PolicyT, ComparatorT, CombineT> unique_sort(comparator, combine, configuration, scheduler);
+
+        return begin + unique_sort.sort(scratch, begin, 0, count, true, configuration.threaded);
+    }
+
+    // As above, allocating a scratch buffer of default constructed items.
+    template <typename PolicyT = DefaultPolicy, typename IteratorT, typename ComparatorT, typename CombineT>
+    IteratorT sort_unique(IteratorT begin, IteratorT end, const ComparatorT & comparator, const CombineT & combine, const Configuration & configuration, Scheduler & scheduler) {
+        std::vector<typename std::iterator_traits<IteratorT>::value_type> scratch(end - begin);
+
+        return sort_unique<PolicyT>(begin, end, comparator, combine, configuration, scheduler, scratch.begin());
+    }
+
+    // Sort a whole container and erase the items which were removed, parallelising the top threaded levels of the tree using the process wide scheduler.
+    template <typename PolicyT = DefaultPolicy, typename ArrayT, typename ComparatorT, typename CombineT = KeepFirst>
+    void sort_unique(ArrayT & array, const ComparatorT & comparator, const CombineT & combine = CombineT(), std::size_t threaded = 2) {
+        Configuration configuration(threaded, PolicyT::PARALLEL_PARTITION_MINIMUM_COUNT, PolicyT::PARALLEL_MERGE_MINIMUM_COUNT);
+
+        array.erase(sort_unique<PolicyT>(array.begin(), array.end(), comparator, combine, configuration, Scheduler::shared()), array.end());
+    }
+}
+
+#endif
@@ -0,0 +1,232 @@
+//
+//  WordStore.h
+//  DictionarySort
+//
+
+#ifndef DictionarySort_WordStore_h
+#define DictionarySort_WordStore_h
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "Scheduler.h"
+
+namespace DictionarySort {
+    /** Packed Word Store.
+
+        A list of words stored as one contiguous buffer of characters, with a delimiter after each word, along with the offset of each word. Compared with a vector of vectors, this uses one allocation for all of the words rather than one per word, and no per word allocation overhead, which for short words is several times the size of the word itself.
+
+        A store can either own its buffer, or reference an existing buffer such as a memory mapped file with one word per line. In the latter case, the only memory the store allocates is the offset of each word.
+
+        Words are identified by a 32-bit index, so that a permutation of the words is half the size of a list of pointers. A store can hold at most 2^32 - 1 words, but any number of characters.
+
+     */
+    template <typename CharT>
+    class WordStore {
+    public:
+        typedef std::uint32_t WordIndexT;
+
+        // Buffers smaller than this are scanned for delimiters on a single thread.
+        static const std::size_t PARALLEL_SCAN_MINIMUM_COUNT = 1024 * 1024;
+
+        // A view of a word in the store, which is valid until the store is modified.
+        class Word {
+        public:
+            Word(const CharT * begin, const CharT * end) : _begin(begin), _end(end) {}
+
+            const CharT * begin() const { return _begin; }
+            const CharT * end() const { return _end; }
+
+            std::size_t size() const { return _end - _begin; }
+            bool empty() const { return _begin == _end; }
+
+            const CharT & operator[](std::size_t index) const { return _begin[index]; }
+
+        protected:
+            const CharT * _begin, * _end;
+        };
+
+        explicit WordStore(CharT delimiter = CharT('\n')) : _delimiter(delimiter), _begin(0), _end(0), _offsets(1, 0) {}
+
+        // Build a store from a buffer containing one word per delimiter, e.g. one word per line. The last word doesn't need to be followed by a delimiter. The buffer is copied.
+        WordStore(const CharT * begin, const CharT * end, CharT delimiter = CharT('\n')) : _delimiter(delimiter), _begin(0), _end(0), _offsets(1, 0) {
+            append(begin, end);
+        }
+
+        CharT delimiter() const { return _delimiter; }
+
+        // Copy each word from a buffer as above.
+        void append(const CharT * begin, const CharT * end) {
+            const CharT * word = begin;
+
+            for (const CharT * current = begin; current != end; ++current) {
+                if (*current == _delimiter) {
+                    push_back(word, current);
+                    word = current + 1;
+                }
+            }
+
+            if (word != end)
+                push_back(word, end);
+        }
+
+        void push_back(const CharT * begin, const CharT * end) {
+            if (_begin)
+                throw std::logic_error("WordStore can't append to a referenced buffer!");
+
+            if (size() == std::numeric_limits<WordIndexT>::max())
+                throw std::length_error("WordStore can't index any more words!");
+
+            _characters.insert(_characters.end(), begin, end);
+            _characters.push_back(_delimiter);
+            _offsets.push_back(_characters.size());
+        }
+
+        // Append any container of characters, e.g. Dictionary::WordT.
+        template <typename WordT>
+        void push_back(const WordT & word) {
+            push_back(word.data(), word.data() + word.size());
+        }
+
+        // Replace the contents of the store with the words in a buffer, without copying it, so the buffer must outlive the store. The buffer is split into one chunk per worker, which are scanned for delimiters in parallel.
+        void reference(const CharT * begin, const CharT * end, ParallelMergeSort::Scheduler & scheduler);
+
+        void reserve(std::size_t words, std::size_t characters) {
+            _offsets.reserve(words + 1);
+            _characters.reserve(characters);
+        }
+
+        void clear() {
+            _begin = _end = 0;
+            _characters.clear();
+            _offsets.resize(1);
+        }
+
+        // The number of words.
+        std::size_t size() const { return _offsets.size() - 1; }
+        bool empty() const { return size() == 0; }
+
+        // The buffer containing every word, each followed by a delimiter, except possibly the last word of a referenced buffer.
+        const CharT * data() const { return _begin ? _begin : _characters.data(); }
+        std::size_t characters() const { return _begin ? _end - _begin : _characters.size(); }
+
+        // The length of the given word, which only reads the offsets.
+        std::size_t length(std::size_t index) const {
+            return _offsets[index+1] - _offsets[index] - 1;
+        }
+
+        Word operator[](std::size_t index) const {
+            const CharT * begin = data() + _offsets[index];
+
+            return Word(begin, begin + length(index));
+        }
+
+        // The given word followed by its delimiter if it has one, e.g. for writing a line to a file.
+        Word line(std::size_t index) const {
+            return Word(data() + _offsets[index], data() + std::min(_offsets[index+1], characters()));
+        }
+
+    protected:
+        CharT _delimiter;
+
+        // The referenced buffer, or 0 if the store owns its characters.
+        const CharT * _begin, * _end;
+        std::vector<CharT> _characters;
+
+        // The offset of each word, followed by the offset after the last delimiter, so that word i is [_offsets[i], _offsets[i+1] - 1]. If the last word of a referenced buffer has no delimiter, the final offset is one past the end of the buffer.
+        std::vector<std::size_t> _offsets;
+
+        // Scans part of a referenced buffer, first counting the delimiters, and then writing the offset after each one.
+        struct ParallelScan {
+            const CharT * buffer;
+            std::size_t lower_bound, upper_bound;
+            CharT delimiter;
+
+            // The number of delimiters, and then where to write their offsets.
+            std::size_t count;
+            std::size_t * offsets;
+
+            void operator()() {
+                const CharT * begin = buffer + lower_bound, * end = buffer + upper_bound;
+
+                if (offsets) {
+                    for (const CharT * current = std::find(begin, end, delimiter); current != end; current = std::find(current + 1, end, delimiter))
+                        *offsets++ = (current - buffer) + 1;
+                } else {
+                    count = std::count(begin, end, delimiter);
+                }
+            }
+        };
+
+        struct ParallelScanTask {
+            ParallelScan & scan;
+
+            void operator()() {
+                scan();
+            }
+        };
+
+        static void execute(std::deque<ParallelScan> & scans, ParallelMergeSort::Scheduler & scheduler) {
+            std::deque<ParallelMergeSort::Scheduler::FunctorTask<ParallelScanTask> > tasks;
+
+            for (std::size_t i = 0; i < scans.size(); i += 1) {
+                ParallelScanTask task = {scans[i]};
+                tasks.emplace_back(task);
+            }
+
+            scheduler.fork_join(tasks);
+        }
+    };
+
+    template <typename CharT>
+    void WordStore<CharT>::reference(const CharT * begin, const CharT * end, ParallelMergeSort::Scheduler & scheduler) {
+        std::size_t count = end - begin;
+        std::size_t chunks = std::max<std::size_t>(1, std::min(scheduler.concurrency(), count / PARALLEL_SCAN_MINIMUM_COUNT));
+
+        clear();
+        std::vector<CharT>().swap(_characters);
+
+        _begin = begin;
+        _end = end;
+
+        std::deque<ParallelScan> scans;
+
+        for (std::size_t i = 0; i < chunks; i += 1) {
+            ParallelScan scan = {begin, count * i / chunks, count * (i+1) / chunks, _delimiter, 0, 0};
+            scans.push_back(scan);
+        }
+
+        execute(scans, scheduler);
+
+        std::size_t words = 0;
+
+        for (std::size_t i = 0; i < chunks; i += 1)
+            words += scans[i].count;
+
+        // The last word may not be followed by a delimiter.
+        bool unterminated = count > 0 && begin[count-1] != _delimiter;
+
+        if (words + unterminated > std::numeric_limits<WordIndexT>::max())
+            throw std::length_error("WordStore can't index this many words!");
+
+        _offsets.resize(1 + words + unterminated);
+
+        std::size_t * offsets = _offsets.data() + 1;
+
+        for (std::size_t i = 0; i < chunks; i += 1) {
+            scans[i].offsets = offsets;
+            offsets += scans[i].count;
+        }
+
+        execute(scans, scheduler);
+
+        if (unterminated)
+            _offsets.back() = count + 1;
+    }
+}
+
+#endif
@@ -6,7 +6,9 @@
 //  Copyright (c) 2011 Orion Transfer Ltd. All rights reserved.
 //
 
+#include <fstream>
 #include <iostream>
+#include <string>
 
 #include "Benchmark.h"
 #include "DictionarySort.h"
@@ -45,15 +47,18 @@ static void test_parallel_merge ()
     ArrayT a(data, data+(sizeof(data)/sizeof(*data)));
     ArrayT b(a.size());
     
-    ParallelMergeSort::ParallelLeftMerge<ArrayT, ComparatorT> left_merge = {a, b, comparator, 0, a.size() / 2};
-    left_merge();
+    ParallelMergeSort::Scheduler & scheduler = ParallelMergeSort::Scheduler::shared();
     
-    std::cout << "After Left: " << b << std::endl;
+    // Merge the lower and upper halves of the output as two independent segments:
+    ParallelMergeSort::ParallelMerge<ArrayT::iterator, ArrayT::iterator, ComparatorT> lower_merge = {a.begin(), b.begin(), comparator, 0, a.size() / 2, a.size(), 0, a.size() / 2, 1, scheduler};
+    lower_merge();
     
-    ParallelMergeSort::ParallelRightMerge<ArrayT, ComparatorT> right_merge = {a, b, comparator, 0, a.size() / 2, a.size()};
-    right_merge();
+    std::cout << "After Lower: " << b << std::endl;
     
-    std::cout << "After Right: " << b << std::endl;
+    ParallelMergeSort::ParallelMerge<ArrayT::iterator, ArrayT::iterator, ComparatorT> upper_merge = {a.begin(), b.begin(), comparator, 0, a.size() / 2, a.size(), a.size() / 2, a.size(), 1, scheduler};
+    upper_merge();
+    
+    std::cout << "After Upper: " << b << std::endl;
 }
 
 static void test_sort ()
@@ -75,35 +80,71 @@ static void test_sort ()
     std::cerr << "Sorted  " << v << std::endl;   
 }
 
-static void test_dictionary ()
+// The number of words used to calibrate a profile.
+const std::size_t CALIBRATION_SAMPLE_COUNT = 250000;
+
+static void test_dictionary (const std::string & profile_path, bool calibrate, const std::string & trace_path)
 {
     // This defines a dictionary based on ASCII characters.
     typedef DictionarySort::Dictionary<char, DictionarySort::IndexT[256]> ASCIIDictionaryT;
     
     // For unicode characters, you could use something like this:
-    // typedef DictionarySort::Dictionary<uint32_t, std::map<uint32_t, DictionarySort::IndexT>> UCS32DictionaryT;
-    // Be aware that 
+    // typedef DictionarySort::Dictionary<uint32_t, DictionarySort::CodepointTable> UCS32DictionaryT;
+    // Or, to sort UTF-8 text directly, without converting it to UCS-4:
+    // typedef DictionarySort::Dictionary<char, DictionarySort::UTF8Table> UTF8DictionaryT;
+    // Be aware that a std::map would also work, but searching the map for every character is much slower.
     
     std::string s = "AaBbCcDdEeFfGgHhIiJjKkLlMmNnOoPpQqRrSsTtUuVvWwXxYyZz";
     ASCIIDictionaryT::WordT alphabet(s.begin(), s.end());
     ASCIIDictionaryT dictionary(alphabet);
     
-    ASCIIDictionaryT::WordsT words, sorted_words;
+    // The words are packed into a single store, and sorted into a permutation without copying them.
+    ASCIIDictionaryT::WordStoreT words;
+    ASCIIDictionaryT::PermutationT permutation;
     const std::size_t MAX_LENGTH = 25;
     const std::size_t MAX_COUNT = 2500000;
+    ASCIIDictionaryT::WordT word;
     for (std::size_t i = 0; i < MAX_COUNT; i += 1) {
-        ASCIIDictionaryT::WordT word;
+        word.clear();
         for (std::size_t j = i; (j-i) <= (i ^ (i * 21)) % MAX_LENGTH; j += 1) {
             word.push_back(alphabet[(j ^ (j << (i % 4))) % alphabet.size()]);
         }
         words.push_back(word);
     }
+    
+    if (calibrate) {
+        ASCIIDictionaryT::WordsT sample;
+        for (std::size_t i = 0; i < std::min(words.size(), CALIBRATION_SAMPLE_COUNT); i += 1) {
+            sample.push_back(ASCIIDictionaryT::WordT(words[i].begin(), words[i].end()));
+        }
+        
+        std::cerr << "Calibrating using " << sample.size() << " words..." << std::endl;
+        dictionary.set_profile(dictionary.calibrate(sample));
         
+        if (dictionary.profile().save(profile_path))
+            std::cerr << "Saved profile to " << profile_path << std::endl;
+        else
+            std::cerr << "Could not save profile to " << profile_path << std::endl;
+    } else {
+        ParallelMergeSort::Profile profile;
+        
+        if (profile.load(profile_path)) {
+            std::cerr << "Loaded profile from " << profile_path << std::endl;
+            dictionary.set_profile(profile);
+        }
+    }
+    
     std::cerr << "Sorting " << words.size() << " words..." << std::endl;
 	std::cerr << "Sort mode = " << DictionarySort::SORT_MODE << std::endl;
+	std::cerr << "Vector kernels = " << DictionarySort::SIMD::kernels().name << std::endl;
 	
-	if (DictionarySort::SORT_MODE > 0)
-		std::cerr << "Parallel merge thread count: " << (1 << DictionarySort::SORT_MODE+1) - 2 << std::endl;
+	if (!dictionary.profile().empty()) {
+		ParallelMergeSort::Configuration configuration = dictionary.profile().configuration(words.size(), ParallelMergeSort::Configuration(0, 0, 0));
+		std::cerr << "Profile configuration: threaded = " << configuration.threaded << ", partition minimum = " << configuration.parallel_partition_minimum_count << ", merge minimum = " << configuration.parallel_merge_minimum_count << std::endl;
+	} else if (DictionarySort::SORT_MODE > 0) {
+		std::cerr << "Parallel merge task count: " << (1 << (DictionarySort::SORT_MODE+1)) - 2 << std::endl;
+		std::cerr << "Scheduler worker count: " << ParallelMergeSort::Scheduler::shared().concurrency() << std::endl;
+	}
 
     const int K = 4;
     Benchmark::WallTime t;
@@ -111,10 +152,24 @@ static void test_dictionary ()
 
     uint64_t checksum;
     for (std::size_t i = 0; i < K; i += 1) {
-        checksum = dictionary.sort(words, sorted_words);
+        // Only the last sort is traced.
+        if (!trace_path.empty())
+            ParallelMergeSort::Trace::clear();
+        
+        checksum = dictionary.sort(words, permutation);
     }
     Benchmark::TimeT elapsed_time = t.total() / K;
     
+    if (!trace_path.empty()) {
+        std::vector<ParallelMergeSort::Trace::Event> events = ParallelMergeSort::Trace::collect();
+        std::ofstream output(trace_path.c_str());
+        
+        ParallelMergeSort::Trace::write_chrome_trace(output, events);
+        ParallelMergeSort::Trace::write_summary(std::cerr, events);
+        
+        std::cerr << "Saved trace to " << trace_path << std::endl;
+    }
+    
     std::cerr << "Checksum: " << checksum << " ? " << (checksum == 479465310674138860) << std::endl;
     std::cerr << "Total Time: " << elapsed_time << std::endl;
 
@@ -123,9 +178,36 @@ static void test_dictionary ()
 
 int main (int argc, const char * argv[])
 {   
+    // The profile is loaded from this file if it exists, or written to it when calibrating.
+    std::string profile_path = "DictionarySort.profile";
+    bool calibrate = false;
+    
+    // The last sort is written to this file as a Chrome trace, if tracing is compiled in.
+    std::string trace_path;
+    
+    for (int i = 1; i < argc; i += 1) {
+        std::string argument = argv[i];
+        
+        if (argument == "--calibrate") {
+            calibrate = true;
+        } else if (argument == "--profile" && i+1 < argc) {
+            profile_path = argv[++i];
+        } else if (argument == "--trace" && i+1 < argc) {
+            trace_path = argv[++i];
+            
+            if (!ParallelMergeSort::Trace::ENABLED) {
+                std::cerr << "Tracing is not compiled in, build with -DPARALLEL_MERGE_SORT_TRACE=1" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--calibrate] [--profile path] [--trace path]" << std::endl;
+            return 1;
+        }
+    }
+    
     //test_parallel_merge();
     //test_sort();
-    test_dictionary();
+    test_dictionary(profile_path, calibrate, trace_path);
     
     return 0;
 }